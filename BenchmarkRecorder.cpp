@@ -0,0 +1,92 @@
+#include "BenchmarkRecorder.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    namespace {
+
+        double getTiming(const BenchmarkFrame& frame, BENCHMARK_TIMING timing)
+        {
+            switch (timing) {
+            case TIMING_CPU:
+                return frame.cpuMs;
+            case TIMING_GPU:
+                return frame.gpuMs;
+            default:
+                return frame.frameMs;
+            }
+        }
+
+        // nearest rank, the smallest sample with at least the fraction of samples at or below it
+        double percentile(const std::vector<double>& sorted, double fraction)
+        {
+            int index = (int)std::ceil(fraction * sorted.size()) - 1;
+            return sorted[std::max(index, 0)];
+        }
+
+    }
+
+    void BenchmarkRecorder::addFrame(const BenchmarkFrame& frame)
+    {
+        frames.push_back(frame);
+    }
+
+    void BenchmarkRecorder::Clear()
+    {
+        frames.clear();
+    }
+
+    bool BenchmarkRecorder::WriteCsv(std::string fileName)
+    {
+        std::ofstream file(fileName.c_str());
+        if (!file) {
+            std::cerr << "ERROR: could not write " << fileName << std::endl;
+            return false;
+        }
+
+        file << "frame,time,cpu_ms,gpu_ms,frame_ms,draw_calls,triangles,vertices,program_switches,"
+            "texture_binds,uniform_uploads,buffer_uploads,buffer_bytes,culled_objects" << std::endl;
+        for (size_t i = 0; i < frames.size(); i++) {
+            const BenchmarkFrame& frame = frames[i];
+            const RenderCounters& counters = frame.counters;
+            file << i << "," << frame.time << "," << frame.cpuMs << "," << frame.gpuMs << "," << frame.frameMs << ","
+                << counters.drawCalls << "," << counters.triangles << "," << counters.vertices << ","
+                << counters.programSwitches << "," << counters.textureBinds << "," << counters.uniformUploads << ","
+                << counters.bufferUploads << "," << counters.bufferBytes << "," << counters.culledObjects << std::endl;
+        }
+        return (bool)file;
+    }
+
+    FrameTimeSummary BenchmarkRecorder::getSummary(BENCHMARK_TIMING timing)
+    {
+        FrameTimeSummary summary = {};
+        if (frames.empty())
+            return summary;
+
+        std::vector<double> sorted;
+        sorted.reserve(frames.size());
+        double total = 0.0;
+        for (const BenchmarkFrame& frame : frames) {
+            sorted.push_back(getTiming(frame, timing));
+            total += sorted.back();
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        summary.averageMs = total / sorted.size();
+        summary.p50Ms = percentile(sorted, 0.50);
+        summary.p95Ms = percentile(sorted, 0.95);
+        summary.p99Ms = percentile(sorted, 0.99);
+        summary.maxMs = sorted.back();
+        return summary;
+    }
+
+    const std::vector<BenchmarkFrame>& BenchmarkRecorder::getFrames()
+    {
+        return frames;
+    }
+
+}
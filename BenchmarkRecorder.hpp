@@ -0,0 +1,52 @@
+#ifndef BenchmarkRecorder_hpp
+#define BenchmarkRecorder_hpp
+
+#include "RenderStats.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    struct BenchmarkFrame {
+        // simulated time of the frame on the benchmark path
+        float time;
+        // submitting the frame on the CPU
+        double cpuMs;
+        // GPU time of the frame, from a timer query
+        double gpuMs;
+        // start of the frame until the GPU finished it
+        double frameMs;
+        RenderCounters counters;
+    };
+
+    enum BENCHMARK_TIMING { TIMING_CPU, TIMING_GPU, TIMING_FRAME };
+
+    struct FrameTimeSummary {
+        double averageMs;
+        double p50Ms;
+        double p95Ms;
+        double p99Ms;
+        double maxMs;
+    };
+
+    // Per-frame timings and counters of a benchmark run, written as CSV with one row per frame
+    // and summarised by nearest-rank percentiles.
+    class BenchmarkRecorder
+    {
+    public:
+        void addFrame(const BenchmarkFrame& frame);
+        void Clear();
+
+        bool WriteCsv(std::string fileName);
+
+        FrameTimeSummary getSummary(BENCHMARK_TIMING timing);
+        const std::vector<BenchmarkFrame>& getFrames();
+
+    private:
+        std::vector<BenchmarkFrame> frames;
+    };
+
+}
+
+#endif /* BenchmarkRecorder_hpp */
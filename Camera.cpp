@@ -20,6 +20,9 @@ namespace gps {
     glm::vec3 Camera::getCameraPosition() {
         return this->cameraPosition;
     }
+    glm::vec3 Camera::getCameraTarget() {
+        return this->cameraTarget;
+    }
 
     //update the camera internal parameters following a camera move event
     void Camera::move(MOVE_DIRECTION direction, float speed) {
@@ -81,4 +84,11 @@ namespace gps {
         this->cameraFrontDirection = glm::normalize(cameraTarget - cameraPosition);
         cameraRightDirection = glm::normalize(glm::cross(cameraFrontDirection, glm::vec3(0.0f, 1.0f, 0.0f)));
     }
+
+    void Camera::setView(glm::vec3 position, glm::vec3 target) {
+        this->cameraPosition = position;
+        this->cameraTarget = target;
+        this->cameraFrontDirection = glm::normalize(cameraTarget - cameraPosition);
+        cameraRightDirection = glm::normalize(glm::cross(cameraFrontDirection, glm::vec3(0.0f, 1.0f, 0.0f)));
+    }
 }
\ No newline at end of file
@@ -25,8 +25,11 @@ namespace gps {
         void rotate(float pitch, float yaw);
 
         void scenePreview(float angle);
+        //place the camera at position, looking at target, used to play back camera paths
+        void setView(glm::vec3 position, glm::vec3 target);
 
         glm::vec3 getCameraPosition();
+        glm::vec3 getCameraTarget();
 
     private:
         glm::vec3 cameraPosition;
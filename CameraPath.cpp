@@ -0,0 +1,127 @@
+#include "CameraPath.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace gps {
+
+    namespace {
+
+        // uniform Catmull-Rom segment from p1 to p2
+        glm::vec3 catmullRom(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float t)
+        {
+            float t2 = t * t;
+            float t3 = t2 * t;
+            return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+                (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+        }
+
+    }
+
+    void CameraPath::addKeyframe(const CameraKeyframe& keyframe)
+    {
+        std::vector<CameraKeyframe>::iterator position = std::upper_bound(keyframes.begin(), keyframes.end(), keyframe,
+            [](const CameraKeyframe& a, const CameraKeyframe& b) { return a.time < b.time; });
+        keyframes.insert(position, keyframe);
+    }
+
+    void CameraPath::Clear()
+    {
+        keyframes.clear();
+    }
+
+    bool CameraPath::Load(std::string fileName)
+    {
+        std::ifstream file(fileName.c_str());
+        if (!file) {
+            std::cerr << "ERROR: could not read " << fileName << std::endl;
+            return false;
+        }
+
+        keyframes.clear();
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line)) {
+            lineNumber++;
+            if (line.empty() || line[0] == '#' || line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+
+            std::istringstream values(line);
+            CameraKeyframe keyframe;
+            values >> keyframe.time
+                >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z
+                >> keyframe.target.x >> keyframe.target.y >> keyframe.target.z
+                >> keyframe.carDistance >> keyframe.lightAngle;
+            if (!values) {
+                std::cerr << "ERROR: " << fileName << " line " << lineNumber << " is not a keyframe" << std::endl;
+                keyframes.clear();
+                return false;
+            }
+            addKeyframe(keyframe);
+        }
+        return !keyframes.empty();
+    }
+
+    bool CameraPath::Save(std::string fileName)
+    {
+        std::ofstream file(fileName.c_str());
+        if (!file) {
+            std::cerr << "ERROR: could not write " << fileName << std::endl;
+            return false;
+        }
+
+        file << "# time, position xyz, target xyz, car distance, light angle" << std::endl;
+        for (const CameraKeyframe& keyframe : keyframes) {
+            file << keyframe.time << " "
+                << keyframe.position.x << " " << keyframe.position.y << " " << keyframe.position.z << " "
+                << keyframe.target.x << " " << keyframe.target.y << " " << keyframe.target.z << " "
+                << keyframe.carDistance << " " << keyframe.lightAngle << std::endl;
+        }
+        return (bool)file;
+    }
+
+    CameraKeyframe CameraPath::Sample(float time)
+    {
+        if (keyframes.empty()) {
+            CameraKeyframe empty = {};
+            return empty;
+        }
+        if (time <= keyframes.front().time) {
+            return keyframes.front();
+        }
+        if (time >= keyframes.back().time) {
+            return keyframes.back();
+        }
+
+        // segment from keyframe i to i + 1, the end keyframes are repeated as the outer control points
+        int i = 0;
+        while (keyframes[i + 1].time <= time)
+            i++;
+        const CameraKeyframe& k0 = keyframes[std::max(i - 1, 0)];
+        const CameraKeyframe& k1 = keyframes[i];
+        const CameraKeyframe& k2 = keyframes[i + 1];
+        const CameraKeyframe& k3 = keyframes[std::min(i + 2, (int)keyframes.size() - 1)];
+        float t = (time - k1.time) / (k2.time - k1.time);
+
+        CameraKeyframe sample;
+        sample.time = time;
+        sample.position = catmullRom(k0.position, k1.position, k2.position, k3.position, t);
+        sample.target = catmullRom(k0.target, k1.target, k2.target, k3.target, t);
+        sample.carDistance = glm::mix(k1.carDistance, k2.carDistance, t);
+        sample.lightAngle = glm::mix(k1.lightAngle, k2.lightAngle, t);
+        return sample;
+    }
+
+    float CameraPath::getDuration()
+    {
+        return keyframes.empty() ? 0.0f : keyframes.back().time;
+    }
+
+    int CameraPath::getKeyframeCount()
+    {
+        return (int)keyframes.size();
+    }
+
+}
@@ -0,0 +1,47 @@
+#ifndef CameraPath_hpp
+#define CameraPath_hpp
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // camera pose and animated scene state at one point in time of a path
+    struct CameraKeyframe {
+        float time;
+        glm::vec3 position;
+        glm::vec3 target;
+        float carDistance;
+        float lightAngle;
+    };
+
+    // Camera path through keyframes, played back by time so every run sees the same frames.
+    // Positions and targets follow a Catmull-Rom spline through the keyframes, the car and the
+    // light move linearly between them.
+    class CameraPath
+    {
+    public:
+        // keyframes are kept sorted by time
+        void addKeyframe(const CameraKeyframe& keyframe);
+        void Clear();
+
+        // text file, one keyframe per line: time, position, target, car distance, light angle
+        // lines starting with # are comments
+        bool Load(std::string fileName);
+        bool Save(std::string fileName);
+
+        // the state at the given time, held at the first or last keyframe outside the path
+        CameraKeyframe Sample(float time);
+        // time of the last keyframe, paths are played from time 0
+        float getDuration();
+        int getKeyframeCount();
+
+    private:
+        std::vector<CameraKeyframe> keyframes;
+    };
+
+}
+
+#endif /* CameraPath_hpp */
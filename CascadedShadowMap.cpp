@@ -0,0 +1,201 @@
+#include "CascadedShadowMap.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    // how far behind a slice, towards the sun, casters are still rendered
+    static const float casterReach = 100.0f;
+    // measured bounds are a few frames old, each side is grown by this fraction of their size plus the padding
+    static const float boundsMargin = 0.1f;
+    static const float boundsPadding = 1.0f;
+
+    void CascadedShadowMap::Create(int resolution, int cascadeCount)
+    {
+        this->resolution = resolution;
+        this->cascadeCount = std::min(cascadeCount, maxCascades);
+
+        //one depth layer per cascade
+        glGenTextures(1, &depthTextureArray);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthTextureArray);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+            resolution, resolution, this->cascadeCount, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        //the layer is attached in Begin
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTextureArray, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        for (int i = 0; i < maxCascades; i++) {
+            lightSpaceTrMatrices[i] = glm::mat4(1.0f);
+            splitDepths[i] = 0.0f;
+        }
+    }
+
+    void CascadedShadowMap::Update(glm::mat4 view, float fovy, float aspect, float nearDepth, float farDepth,
+        glm::vec3 lightDirection, float splitLambda)
+    {
+        float splits[maxCascades];
+        ComputeSplits(nearDepth, farDepth, splitLambda, splits);
+        Update(view, fovy, aspect, nearDepth, splits, lightDirection, glm::mat4(1.0f), NULL);
+    }
+
+    void CascadedShadowMap::Update(glm::mat4 view, float fovy, float aspect, float nearDepth, const float splits[],
+        glm::vec3 lightDirection, glm::mat4 boundsLightView, const glm::vec4 bounds[])
+    {
+        // the light view only depends on the sun, so snapping in its space is stable as the camera moves
+        glm::vec3 toLight = glm::normalize(lightDirection);
+        glm::vec3 up = std::abs(toLight.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        lightView = glm::lookAt(glm::vec3(0.0f), -toLight, up);
+
+        // bounds measured before the sun turned are in another space
+        if (boundsLightView != lightView)
+            bounds = NULL;
+
+        glm::mat4 inverseView = glm::inverse(view);
+        float tanHalfFovY = std::tan(fovy * 0.5f);
+
+        float sliceNear = nearDepth;
+        for (int i = 0; i < cascadeCount; i++) {
+            float sliceFar = splits[i];
+            FitCascade(i, inverseView, tanHalfFovY, aspect, sliceNear, sliceFar, bounds ? &bounds[i] : NULL);
+            splitDepths[i] = sliceFar;
+            sliceNear = sliceFar;
+        }
+    }
+
+    void CascadedShadowMap::ComputeSplits(float nearDepth, float farDepth, float splitLambda, float splits[])
+    {
+        for (int i = 0; i < cascadeCount; i++) {
+            // practical split scheme, a blend of logarithmic and uniform distances
+            float fraction = (float)(i + 1) / (float)cascadeCount;
+            float logSplit = nearDepth * std::pow(farDepth / nearDepth, fraction);
+            float uniformSplit = nearDepth + (farDepth - nearDepth) * fraction;
+            splits[i] = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+        }
+    }
+
+    void CascadedShadowMap::FitCascade(int cascade, glm::mat4 inverseView, float tanHalfFovY, float aspect,
+        float sliceNear, float sliceFar, const glm::vec4* bounds)
+    {
+        //corners of the slice in world space
+        glm::vec3* corners = sliceCorners[cascade];
+        int corner = 0;
+        for (int z = 0; z < 2; z++) {
+            float depth = z == 0 ? sliceNear : sliceFar;
+            float halfHeight = depth * tanHalfFovY;
+            float halfWidth = halfHeight * aspect;
+            for (int y = -1; y <= 1; y += 2) {
+                for (int x = -1; x <= 1; x += 2) {
+                    corners[corner++] = glm::vec3(inverseView * glm::vec4(x * halfWidth, y * halfHeight, -depth, 1.0f));
+                }
+            }
+        }
+
+        // a bounding sphere keeps the cascade size constant when the camera turns
+        glm::vec3 center(0.0f);
+        for (int i = 0; i < 8; i++) {
+            center += corners[i];
+        }
+        center /= 8.0f;
+        float radius = 0.0f;
+        for (int i = 0; i < 8; i++) {
+            radius = std::max(radius, glm::length(corners[i] - center));
+        }
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        // move the center in whole texels so the rasterized shadows do not shimmer
+        float texelSize = 2.0f * radius / (float)resolution;
+        glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+        lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+        lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+        glm::vec2 lightMin(lightCenter.x - radius, lightCenter.y - radius);
+        glm::vec2 lightMax(lightCenter.x + radius, lightCenter.y + radius);
+
+        // the visible samples usually cover far less than the slice, an empty slice has min > max
+        if (bounds && bounds->x <= bounds->z && bounds->y <= bounds->w) {
+            float size = std::max(bounds->z - bounds->x, bounds->w - bounds->y);
+            float extent = size + 2.0f * (boundsMargin * size + boundsPadding);
+            if (extent < 2.0f * radius) {
+                // square, its size and origin stepped in whole texels of the rounded size
+                extent = std::ceil(extent);
+                float fittedTexel = extent / (float)resolution;
+                glm::vec2 boundsCenter(0.5f * (bounds->x + bounds->z), 0.5f * (bounds->y + bounds->w));
+                lightMin = glm::floor((boundsCenter - extent * 0.5f) / fittedTexel) * fittedTexel;
+                lightMax = lightMin + extent;
+            }
+        }
+
+        // the light looks down -z, casters between the slice and the sun are kept
+        glm::mat4 lightProjection = glm::ortho(lightMin.x, lightMax.x, lightMin.y, lightMax.y,
+            -lightCenter.z - radius - casterReach, -lightCenter.z + radius);
+        lightSpaceTrMatrices[cascade] = lightProjection * lightView;
+    }
+
+    void CascadedShadowMap::Begin(int cascade)
+    {
+        glViewport(0, 0, resolution, resolution);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTextureArray, 0, cascade);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    void CascadedShadowMap::End()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void CascadedShadowMap::Delete()
+    {
+        if (framebuffer) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteTextures(1, &depthTextureArray);
+            framebuffer = 0;
+            depthTextureArray = 0;
+        }
+    }
+
+    int CascadedShadowMap::getCascadeCount()
+    {
+        return cascadeCount;
+    }
+
+    GLuint CascadedShadowMap::getTexture()
+    {
+        return depthTextureArray;
+    }
+
+    glm::mat4 CascadedShadowMap::getLightSpaceTrMatrix(int cascade)
+    {
+        return lightSpaceTrMatrices[cascade];
+    }
+
+    float CascadedShadowMap::getSplitDepth(int cascade)
+    {
+        return splitDepths[cascade];
+    }
+
+    void CascadedShadowMap::getSliceCorners(int cascade, glm::vec3 corners[8])
+    {
+        for (int i = 0; i < 8; i++) {
+            corners[i] = sliceCorners[cascade][i];
+        }
+    }
+
+    glm::mat4 CascadedShadowMap::getLightView()
+    {
+        return lightView;
+    }
+
+}
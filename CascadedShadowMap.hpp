@@ -0,0 +1,62 @@
+#ifndef CascadedShadowMap_hpp
+#define CascadedShadowMap_hpp
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+namespace gps {
+
+    // Directional light shadows split into cascades along the camera frustum, stored as the
+    // layers of one depth texture array. Each cascade is a stable, texel snapped orthographic
+    // projection around a bounding sphere of its frustum slice, so shadows do not shimmer, or
+    // is tightened to the light space bounds of the samples actually visible in the slice.
+    class CascadedShadowMap
+    {
+    public:
+        static const int maxCascades = 4;
+
+        void Create(int resolution, int cascadeCount);
+        // splits the camera frustum between nearDepth and farDepth and fits one cascade to each
+        // slice, splitLambda blends between uniform (0) and logarithmic (1) split distances
+        void Update(glm::mat4 view, float fovy, float aspect, float nearDepth, float farDepth,
+            glm::vec3 lightDirection, float splitLambda);
+        // fits the cascades to given split distances, each one to the minX, minY, maxX, maxY light
+        // space bounds of its samples when they were found under the same light view and are tighter
+        // than the bounding sphere, bounds may be NULL
+        void Update(glm::mat4 view, float fovy, float aspect, float nearDepth, const float splits[],
+            glm::vec3 lightDirection, glm::mat4 boundsLightView, const glm::vec4 bounds[]);
+        // the split distances Update uses for nearDepth, farDepth and splitLambda
+        void ComputeSplits(float nearDepth, float farDepth, float splitLambda, float splits[]);
+        // binds the layer of the cascade, sets the viewport and clears the depth
+        void Begin(int cascade);
+        void End();
+        void Delete();
+
+        int getCascadeCount();
+        GLuint getTexture();
+        glm::mat4 getLightSpaceTrMatrix(int cascade);
+        // view space distance where each cascade ends
+        float getSplitDepth(int cascade);
+        // world space corners of the camera frustum slice the cascade covers
+        void getSliceCorners(int cascade, glm::vec3 corners[8]);
+        // shared by all cascades, looks down -z along the light direction
+        glm::mat4 getLightView();
+
+    private:
+        GLuint framebuffer = 0;
+        GLuint depthTextureArray = 0;
+        int resolution = 0;
+        int cascadeCount = 0;
+
+        glm::mat4 lightSpaceTrMatrices[maxCascades];
+        float splitDepths[maxCascades];
+        glm::vec3 sliceCorners[maxCascades][8];
+        glm::mat4 lightView;
+
+        void FitCascade(int cascade, glm::mat4 inverseView, float tanHalfFovY, float aspect,
+            float sliceNear, float sliceFar, const glm::vec4* bounds);
+    };
+
+}
+
+#endif /* CascadedShadowMap_hpp */
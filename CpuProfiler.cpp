@@ -0,0 +1,203 @@
+#include "CpuProfiler.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace gps {
+
+    namespace {
+
+        struct ZoneEvent {
+            const char* name;
+            long long beginTime;
+            long long endTime;
+        };
+
+        // zones are appended to a chunk and published by count, full chunks are linked and only
+        // freed by Shutdown
+        struct EventChunk {
+            static const int capacity = 4096;
+            ZoneEvent events[capacity];
+            std::atomic<int> count{ 0 };
+            std::atomic<EventChunk*> next{ nullptr };
+        };
+
+        // about 100 MB of zones per thread, a few million zones
+        const int maxChunksPerThread = 1024;
+
+        struct ThreadBuffer {
+            int threadId;
+            std::atomic<const char*> name{ nullptr };
+            EventChunk* first;
+            // only touched by the owning thread
+            EventChunk* last;
+            int chunkCount;
+            std::atomic<long long> dropped{ 0 };
+        };
+
+        std::atomic<bool> enabled{ false };
+        const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+        // registration is the only locked step, once per thread
+        std::mutex threadsMutex;
+        std::vector<ThreadBuffer*> threads;
+        // raised by Shutdown, buffers of an older generation are gone
+        std::atomic<int> generation{ 0 };
+
+        ThreadBuffer* getThreadBuffer()
+        {
+            thread_local ThreadBuffer* buffer = nullptr;
+            thread_local int bufferGeneration = 0;
+            if (!buffer || bufferGeneration != generation.load(std::memory_order_acquire)) {
+                buffer = new ThreadBuffer();
+                buffer->first = buffer->last = new EventChunk();
+                buffer->chunkCount = 1;
+                std::lock_guard<std::mutex> lock(threadsMutex);
+                buffer->threadId = (int)threads.size() + 1;
+                threads.push_back(buffer);
+                bufferGeneration = generation.load(std::memory_order_relaxed);
+            }
+            return buffer;
+        }
+
+        void writeJsonString(FILE* file, const char* text)
+        {
+            fputc('"', file);
+            for (const char* c = text; *c; c++) {
+                if (*c == '"' || *c == '\\')
+                    fputc('\\', file);
+                fputc(*c, file);
+            }
+            fputc('"', file);
+        }
+
+    }
+
+    void CpuProfiler::setEnabled(bool enable)
+    {
+        enabled.store(enable, std::memory_order_relaxed);
+    }
+
+    bool CpuProfiler::isEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void CpuProfiler::setThreadName(const char* name)
+    {
+        if (!isEnabled())
+            return;
+        getThreadBuffer()->name.store(name, std::memory_order_release);
+    }
+
+    long long CpuProfiler::getTime()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+    }
+
+    void CpuProfiler::RecordZone(const char* name, long long beginTime, long long endTime)
+    {
+        // a zone begun before Shutdown ends after it
+        if (!isEnabled())
+            return;
+
+        ThreadBuffer* buffer = getThreadBuffer();
+        EventChunk* chunk = buffer->last;
+        int index = chunk->count.load(std::memory_order_relaxed);
+        if (index == EventChunk::capacity) {
+            if (buffer->chunkCount == maxChunksPerThread) {
+                buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            buffer->chunkCount++;
+            EventChunk* next = new EventChunk();
+            chunk->next.store(next, std::memory_order_release);
+            buffer->last = chunk = next;
+            index = 0;
+        }
+        chunk->events[index] = { name, beginTime, endTime };
+        chunk->count.store(index + 1, std::memory_order_release);
+    }
+
+    long long CpuProfiler::getZoneCount()
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        long long zoneCount = 0;
+        for (ThreadBuffer* buffer : threads) {
+            for (EventChunk* chunk = buffer->first; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+                zoneCount += chunk->count.load(std::memory_order_acquire);
+            }
+        }
+        return zoneCount;
+    }
+
+    long long CpuProfiler::getDroppedZoneCount()
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        long long droppedCount = 0;
+        for (ThreadBuffer* buffer : threads) {
+            droppedCount += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        return droppedCount;
+    }
+
+    void CpuProfiler::Shutdown()
+    {
+        setEnabled(false);
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (ThreadBuffer* buffer : threads) {
+            EventChunk* chunk = buffer->first;
+            while (chunk) {
+                EventChunk* next = chunk->next.load(std::memory_order_acquire);
+                delete chunk;
+                chunk = next;
+            }
+            delete buffer;
+        }
+        threads.clear();
+        generation.fetch_add(1, std::memory_order_release);
+    }
+
+    bool CpuProfiler::WriteTrace(std::string fileName)
+    {
+        FILE* file = fopen(fileName.c_str(), "w");
+        if (!file)
+            return false;
+
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool firstEvent = true;
+        for (ThreadBuffer* buffer : threads) {
+            const char* threadName = buffer->name.load(std::memory_order_acquire);
+            if (threadName) {
+                fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                    firstEvent ? "" : ",\n", buffer->threadId);
+                writeJsonString(file, threadName);
+                fprintf(file, "}}");
+                firstEvent = false;
+            }
+
+            // timestamps in microseconds, the fraction keeps the nanoseconds
+            for (EventChunk* chunk = buffer->first; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+                int count = chunk->count.load(std::memory_order_acquire);
+                for (int i = 0; i < count; i++) {
+                    const ZoneEvent& event = chunk->events[i];
+                    fprintf(file, "%s{\"name\":", firstEvent ? "" : ",\n");
+                    writeJsonString(file, event.name);
+                    fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld.%03lld,\"dur\":%lld.%03lld}",
+                        buffer->threadId, event.beginTime / 1000, event.beginTime % 1000,
+                        (event.endTime - event.beginTime) / 1000, (event.endTime - event.beginTime) % 1000);
+                    firstEvent = false;
+                }
+            }
+        }
+        fprintf(file, "\n]}\n");
+        bool written = !ferror(file);
+        fclose(file);
+        return written;
+    }
+
+}
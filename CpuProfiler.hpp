@@ -0,0 +1,66 @@
+#ifndef CpuProfiler_hpp
+#define CpuProfiler_hpp
+
+#include <string>
+
+// times the enclosing scope when the CPU profiler is enabled, name must be a string literal
+#define PROFILE_ZONE(name) PROFILE_ZONE_AT_LINE(name, __LINE__)
+#define PROFILE_ZONE_AT_LINE(name, line) PROFILE_ZONE_VARIABLE(name, line)
+#define PROFILE_ZONE_VARIABLE(name, line) gps::ProfileZone profileZone##line(name)
+
+namespace gps {
+
+    // Scoped CPU zones with nanosecond timestamps, written as Chrome trace JSON for
+    // chrome://tracing or Perfetto. Every thread records into buffers of its own, which are only
+    // appended to and published with an atomic count, so recording takes no lock and the trace
+    // can be written while other threads keep recording. A thread stops recording once its
+    // buffers are full and counts the zones it drops. While disabled a zone costs one relaxed
+    // atomic load.
+    class CpuProfiler
+    {
+    public:
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+        // name of the calling thread in the trace, a string literal, ignored while disabled
+        static void setThreadName(const char* name);
+
+        // a complete zone of the calling thread, times in nanoseconds from getTime
+        static void RecordZone(const char* name, long long beginTime, long long endTime);
+        static long long getTime();
+
+        // writes every zone recorded so far, false when the file cannot be written
+        static bool WriteTrace(std::string fileName);
+        static long long getZoneCount();
+        static long long getDroppedZoneCount();
+        // disables the profiler and frees every buffer, once the other threads stopped recording
+        static void Shutdown();
+    };
+
+    class ProfileZone
+    {
+    public:
+        explicit ProfileZone(const char* name)
+        {
+            if (CpuProfiler::isEnabled()) {
+                this->name = name;
+                beginTime = CpuProfiler::getTime();
+            }
+        }
+
+        ~ProfileZone()
+        {
+            if (name)
+                CpuProfiler::RecordZone(name, beginTime, CpuProfiler::getTime());
+        }
+
+        ProfileZone(const ProfileZone&) = delete;
+        ProfileZone& operator=(const ProfileZone&) = delete;
+
+    private:
+        const char* name = nullptr;
+        long long beginTime = 0;
+    };
+
+}
+
+#endif /* CpuProfiler_hpp */
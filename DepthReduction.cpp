@@ -0,0 +1,252 @@
+#include "DepthReduction.hpp"
+#include "RenderStats.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+
+namespace gps {
+
+    void DepthReduction::Create(int width, int height, GLenum depthFormat)
+    {
+        this->width = width;
+        this->height = height;
+        this->depthFormat = depthFormat;
+
+        //min/max chain, level 0 is half the depth target and the last level a single texel
+        glGenTextures(1, &reduceTexture);
+        glBindTexture(GL_TEXTURE_2D, reduceTexture);
+        glGenTextures(1, &boundsTexture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, boundsTexture);
+        int levelWidth = width;
+        int levelHeight = height;
+        levelCount = 0;
+        do {
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+            glTexImage2D(GL_TEXTURE_2D, levelCount, GL_RG32F, levelWidth, levelHeight, 0, GL_RG, GL_FLOAT, NULL);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, levelCount, GL_RGBA32F, levelWidth, levelHeight, maxPartitions, 0,
+                GL_RGBA, GL_FLOAT, NULL);
+            levelCount++;
+        } while (levelWidth > 1 || levelHeight > 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        //the range goes to the first attachment and the bounds of each partition to the next ones
+        glGenFramebuffers(1, &reduceFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, reduceFramebuffer);
+        GLenum drawBuffers[1 + maxPartitions];
+        for (int i = 0; i < 1 + maxPartitions; i++) {
+            drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+        }
+        glDrawBuffers(1 + maxPartitions, drawBuffers);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        //the reduction draws one triangle generated in the vertex shader
+        glGenVertexArrays(1, &emptyVAO);
+
+        glGenBuffers(readbackCount, pixelBuffers);
+        for (int i = 0; i < readbackCount; i++) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (2 + 4 * maxPartitions) * sizeof(GLfloat), NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    GLuint DepthReduction::CopyDepth()
+    {
+        if (!copyTexture) {
+            //a depth blit needs the same format on both sides
+            bool stencil = depthFormat == GL_DEPTH24_STENCIL8 || depthFormat == GL_DEPTH32F_STENCIL8;
+            GLenum type = depthFormat == GL_DEPTH24_STENCIL8 ? GL_UNSIGNED_INT_24_8 :
+                depthFormat == GL_DEPTH32F_STENCIL8 ? GL_FLOAT_32_UNSIGNED_INT_24_8_REV : GL_FLOAT;
+            glGenTextures(1, &copyTexture);
+            glBindTexture(GL_TEXTURE_2D, copyTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, depthFormat, width, height, 0,
+                stencil ? GL_DEPTH_STENCIL : GL_DEPTH_COMPONENT, type, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            glGenFramebuffers(1, &copyFramebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, copyFramebuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+                GL_TEXTURE_2D, copyTexture, 0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+
+        //a multisampled window is resolved by the blit, which needs the same size on both sides
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copyFramebuffer);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return copyTexture;
+    }
+
+    void DepthReduction::Reduce(gps::Shader reduceShader, GLuint depthTexture, glm::mat4 view, glm::mat4 projection,
+        const Partitions& partitions)
+    {
+        ReadBack();
+
+        reduceShader.useShaderProgram();
+        glUniform1i(glGetUniformLocation(reduceShader.shaderProgram, "source"), 0);
+        glUniform1i(glGetUniformLocation(reduceShader.shaderProgram, "sourceBounds"), 1);
+        glm::mat4 inverseProjection = glm::inverse(projection);
+        glUniformMatrix4fv(glGetUniformLocation(reduceShader.shaderProgram, "inverseProjection"), 1, GL_FALSE,
+            glm::value_ptr(inverseProjection));
+        glm::mat4 viewToLight = partitions.lightView * glm::inverse(view);
+        glUniformMatrix4fv(glGetUniformLocation(reduceShader.shaderProgram, "viewToLight"), 1, GL_FALSE,
+            glm::value_ptr(viewToLight));
+        int partitionCount = std::max(1, std::min(partitions.count, (int)maxPartitions));
+        glUniform1i(glGetUniformLocation(reduceShader.shaderProgram, "partitionCount"), partitionCount);
+        glUniform1fv(glGetUniformLocation(reduceShader.shaderProgram, "partitionSplits"), partitionCount,
+            partitions.splits);
+        GLint linearizeLoc = glGetUniformLocation(reduceShader.shaderProgram, "linearize");
+
+        glDisable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, reduceFramebuffer);
+        glBindVertexArray(emptyVAO);
+        glActiveTexture(GL_TEXTURE0);
+
+        int levelWidth = width;
+        int levelHeight = height;
+        for (int level = 0; level < levelCount; level++) {
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+
+            if (level == 0) {
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, depthTexture);
+                glUniform1i(linearizeLoc, 1);
+            }
+            else {
+                // only the previous level is visible to the shader, the one being written is not
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, boundsTexture);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, level - 1);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, level - 1);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, reduceTexture);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+                glUniform1i(linearizeLoc, 0);
+            }
+
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, reduceTexture, level);
+            for (int i = 0; i < maxPartitions; i++) {
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1 + i, boundsTexture, level, i);
+            }
+            glViewport(0, 0, levelWidth, levelHeight);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            RenderStats::countTextureBinds(level == 0 ? 1 : 2);
+            RenderStats::countDraw(GL_TRIANGLES, 3);
+        }
+
+        // queue the readback of the last texels, skipped while every buffer is still in flight
+        if (!fences[writeIndex]) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[writeIndex]);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glReadPixels(0, 0, 1, 1, GL_RG, GL_FLOAT, 0);
+            for (int i = 0; i < partitionCount; i++) {
+                glReadBuffer(GL_COLOR_ATTACHMENT1 + i);
+                glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, (void*)((2 + 4 * i) * sizeof(GLfloat)));
+            }
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            fences[writeIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            pending[writeIndex] = partitions;
+            pending[writeIndex].count = partitionCount;
+            writeIndex = (writeIndex + 1) % readbackCount;
+        }
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    void DepthReduction::ReadBack()
+    {
+        // results arrive in order, take every one the GPU has finished
+        while (fences[readIndex]) {
+            GLenum status = glClientWaitSync(fences[readIndex], 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+
+            glDeleteSync(fences[readIndex]);
+            fences[readIndex] = 0;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[readIndex]);
+            GLfloat* range = (GLfloat*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                (2 + 4 * pending[readIndex].count) * sizeof(GLfloat), GL_MAP_READ_BIT);
+            if (range) {
+                minDepth = range[0];
+                maxDepth = range[1];
+                partitions = pending[readIndex];
+                for (int i = 0; i < partitions.count; i++) {
+                    partitions.bounds[i] = glm::vec4(range[2 + 4 * i], range[3 + 4 * i], range[4 + 4 * i], range[5 + 4 * i]);
+                }
+                hasRange = true;
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            readIndex = (readIndex + 1) % readbackCount;
+        }
+    }
+
+    bool DepthReduction::getDepthRange(float& minDepth, float& maxDepth)
+    {
+        // an empty screen reduces to min > max
+        if (!hasRange || this->minDepth >= this->maxDepth)
+            return false;
+        minDepth = this->minDepth;
+        maxDepth = this->maxDepth;
+        return true;
+    }
+
+    bool DepthReduction::getPartitions(Partitions& partitions)
+    {
+        if (!hasRange || this->minDepth >= this->maxDepth)
+            return false;
+        partitions = this->partitions;
+        return true;
+    }
+
+    void DepthReduction::Delete()
+    {
+        if (reduceFramebuffer) {
+            for (int i = 0; i < readbackCount; i++) {
+                if (fences[i]) {
+                    glDeleteSync(fences[i]);
+                    fences[i] = 0;
+                }
+            }
+            glDeleteBuffers(readbackCount, pixelBuffers);
+            glDeleteVertexArrays(1, &emptyVAO);
+            glDeleteFramebuffers(1, &reduceFramebuffer);
+            glDeleteTextures(1, &reduceTexture);
+            glDeleteTextures(1, &boundsTexture);
+            if (copyTexture) {
+                glDeleteFramebuffers(1, &copyFramebuffer);
+                glDeleteTextures(1, &copyTexture);
+                copyFramebuffer = 0;
+                copyTexture = 0;
+            }
+            reduceFramebuffer = 0;
+        }
+    }
+
+}
@@ -0,0 +1,80 @@
+#ifndef DepthReduction_hpp
+#define DepthReduction_hpp
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+
+namespace gps {
+
+    // Finds the range of view depths actually visible on screen. The depth buffer of the main
+    // pass is reduced to its min/max by fragment passes down a mip chain and the final texel is
+    // read back through a ring of pixel buffers, a few frames late but without stalls. The same
+    // passes bin the samples into view depth partitions and reduce the light space x/y bounds of
+    // each, so shadow cascades can be fitted to what is actually visible.
+    class DepthReduction
+    {
+    public:
+        static const int maxPartitions = 4;
+
+        // partitions of the visible samples along the view direction
+        struct Partitions {
+            int count;
+            // view space distance where each partition ends, samples past the last one are left out
+            float splits[maxPartitions];
+            // the light view the bounds are in
+            glm::mat4 lightView;
+            // minX, minY, maxX, maxY of the samples of each partition, min > max when it has none
+            glm::vec4 bounds[maxPartitions];
+        };
+
+        // the size of the depth buffers reduced, depthFormat is the one of the window's
+        void Create(int width, int height, GLenum depthFormat);
+        // the window's depth buffer cannot be sampled and may be multisampled, it is copied into a
+        // texture of the same format, returned for Reduce
+        GLuint CopyDepth();
+        // reduces a depth texture drawn with view and projection to linear min/max depth and to the
+        // bounds of partitions, only count, splits and lightView are read, then queues the readback
+        void Reduce(gps::Shader reduceShader, GLuint depthTexture, glm::mat4 view, glm::mat4 projection,
+            const Partitions& partitions);
+        // latest range read back, false until one arrives or when nothing was drawn
+        bool getDepthRange(float& minDepth, float& maxDepth);
+        // partitions of the latest readback, with the splits and light view they were binned with
+        bool getPartitions(Partitions& partitions);
+        void Delete();
+
+    private:
+        static const int readbackCount = 3;
+
+        int width = 0;
+        int height = 0;
+        GLenum depthFormat = GL_DEPTH_COMPONENT24;
+        // allocated on the first copy, the deferred path reduces the G-buffer depth instead
+        GLuint copyFramebuffer = 0;
+        GLuint copyTexture = 0;
+        GLuint reduceFramebuffer = 0;
+        GLuint reduceTexture = 0;
+        // one layer per partition, with the same levels as reduceTexture
+        GLuint boundsTexture = 0;
+        int levelCount = 0;
+        GLuint emptyVAO = 0;
+
+        GLuint pixelBuffers[readbackCount] = {};
+        GLsync fences[readbackCount] = {};
+        // what each readback in flight was binned with
+        Partitions pending[readbackCount] = {};
+        int readIndex = 0;
+        int writeIndex = 0;
+
+        bool hasRange = false;
+        float minDepth = 0.0f;
+        float maxDepth = 0.0f;
+        Partitions partitions = {};
+
+        void ReadBack();
+    };
+
+}
+
+#endif /* DepthReduction_hpp */
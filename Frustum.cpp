@@ -0,0 +1,74 @@
+#include "Frustum.hpp"
+
+namespace gps {
+
+    BoundingBox transformBoundingBox(BoundingBox box, glm::mat4 transform) {
+        BoundingBox result;
+        glm::vec3 corner = glm::vec3(transform * glm::vec4(box.min, 1.0f));
+        result.min = corner;
+        result.max = corner;
+        for (int i = 1; i < 8; i++) {
+            glm::vec3 localCorner(
+                (i & 1) ? box.max.x : box.min.x,
+                (i & 2) ? box.max.y : box.min.y,
+                (i & 4) ? box.max.z : box.min.z);
+            corner = glm::vec3(transform * glm::vec4(localCorner, 1.0f));
+            result.min = glm::min(result.min, corner);
+            result.max = glm::max(result.max, corner);
+        }
+        return result;
+    }
+
+    void Frustum::extract(glm::mat4 viewProjection) {
+        // rows of the combined matrix (glm is column major)
+        glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+        glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+        glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+        glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+        planes[0] = row3 + row0;
+        planes[1] = row3 - row0;
+        planes[2] = row3 + row1;
+        planes[3] = row3 - row1;
+        planes[4] = row3 + row2;
+        planes[5] = row3 - row2;
+
+        for (int i = 0; i < 6; i++) {
+            planes[i] = planes[i] / glm::length(glm::vec3(planes[i]));
+        }
+    }
+
+    bool Frustum::intersects(BoundingBox box) {
+        for (int i = 0; i < 6; i++) {
+            // test the box corner furthest along the plane normal
+            glm::vec3 positive(
+                planes[i].x >= 0.0f ? box.max.x : box.min.x,
+                planes[i].y >= 0.0f ? box.max.y : box.min.y,
+                planes[i].z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(planes[i]), positive) + planes[i].w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void ShadowCasterVolume::build(glm::mat4 lightView, const glm::vec3* corners, int cornerCount) {
+        this->lightView = lightView;
+        bounds.min = glm::vec3(lightView * glm::vec4(corners[0], 1.0f));
+        bounds.max = bounds.min;
+        for (int i = 1; i < cornerCount; i++) {
+            glm::vec3 corner = glm::vec3(lightView * glm::vec4(corners[i], 1.0f));
+            bounds.min = glm::min(bounds.min, corner);
+            bounds.max = glm::max(bounds.max, corner);
+        }
+    }
+
+    bool ShadowCasterVolume::intersects(BoundingBox box) {
+        BoundingBox lightBox = transformBoundingBox(box, lightView);
+        // the light looks down -z, so casters only need to start before the farthest receiver
+        return lightBox.max.x >= bounds.min.x && lightBox.min.x <= bounds.max.x &&
+            lightBox.max.y >= bounds.min.y && lightBox.min.y <= bounds.max.y &&
+            lightBox.max.z >= bounds.min.z;
+    }
+
+}
@@ -0,0 +1,43 @@
+#ifndef Frustum_hpp
+#define Frustum_hpp
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+
+namespace gps {
+
+    // returns the world space box enclosing a local box transformed by the given matrix
+    BoundingBox transformBoundingBox(BoundingBox box, glm::mat4 transform);
+
+    class Frustum
+    {
+    public:
+        //extract the six clipping planes from a projection * view matrix
+        void extract(glm::mat4 viewProjection);
+        //true if the box is at least partially inside the frustum
+        bool intersects(BoundingBox box);
+
+    private:
+        // left, right, bottom, top, near, far - xyz is the normal, w the distance
+        glm::vec4 planes[6];
+    };
+
+    // Everything that can cast a shadow onto a set of receiver points: their bounds in light
+    // space, extruded towards the light without limit.
+    class ShadowCasterVolume
+    {
+    public:
+        //lightView looks down -z towards the receivers, given in world space
+        void build(glm::mat4 lightView, const glm::vec3* corners, int cornerCount);
+        //true if the world space box may shadow one of the receivers
+        bool intersects(BoundingBox box);
+
+    private:
+        glm::mat4 lightView;
+        BoundingBox bounds;
+    };
+
+}
+
+#endif /* Frustum_hpp */
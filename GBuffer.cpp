@@ -0,0 +1,125 @@
+#include "GBuffer.hpp"
+#include "RenderStats.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    GLuint GBuffer::CreateTarget(GLint internalFormat, GLenum format, GLenum type)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+        //read back one texel per pixel
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void GBuffer::Create(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+
+        //sRGB albedo keeps the precision of the textures in 8 bits, normals need more
+        albedoTexture = CreateTarget(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        normalTexture = CreateTarget(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT);
+        materialTexture = CreateTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        depthTexture = CreateTarget(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, materialTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "G-buffer framebuffer is incomplete" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        //the composite draws one triangle generated in the vertex shader
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    void GBuffer::Begin()
+    {
+        glViewport(0, 0, width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        //the window's clear colour is left alone, empty pixels are skipped by their depth anyway
+        const GLfloat empty[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 3; i++) {
+            glClearBufferfv(GL_COLOR, i, empty);
+        }
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    void GBuffer::End()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void GBuffer::Composite(gps::Shader lightingShader)
+    {
+        lightingShader.useShaderProgram();
+        glUniform1i(glGetUniformLocation(lightingShader.shaderProgram, "gAlbedo"), 0);
+        glUniform1i(glGetUniformLocation(lightingShader.shaderProgram, "gNormal"), 1);
+        glUniform1i(glGetUniformLocation(lightingShader.shaderProgram, "gMaterial"), 2);
+        glUniform1i(glGetUniformLocation(lightingShader.shaderProgram, "gDepth"), 3);
+
+        GLuint textures[] = { albedoTexture, normalTexture, materialTexture, depthTexture };
+        for (int i = 0; i < 4; i++) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+        }
+        RenderStats::countTextureBinds(4);
+
+        //the shader writes the G-buffer depth, so later forward draws still depth test against the scene
+        glDepthFunc(GL_ALWAYS);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        RenderStats::countDraw(GL_TRIANGLES, 3);
+        glBindVertexArray(0);
+        glDepthFunc(GL_LESS);
+    }
+
+    void GBuffer::Delete()
+    {
+        if (framebuffer) {
+            glDeleteVertexArrays(1, &emptyVAO);
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteTextures(1, &albedoTexture);
+            glDeleteTextures(1, &normalTexture);
+            glDeleteTextures(1, &materialTexture);
+            glDeleteTextures(1, &depthTexture);
+            framebuffer = 0;
+        }
+    }
+
+    GLuint GBuffer::getAlbedoTexture()
+    {
+        return albedoTexture;
+    }
+
+    GLuint GBuffer::getNormalTexture()
+    {
+        return normalTexture;
+    }
+
+    GLuint GBuffer::getMaterialTexture()
+    {
+        return materialTexture;
+    }
+
+    GLuint GBuffer::getDepthTexture()
+    {
+        return depthTexture;
+    }
+
+}
@@ -0,0 +1,44 @@
+#ifndef GBuffer_hpp
+#define GBuffer_hpp
+
+#include <GL/glew.h>
+
+#include "Shader.hpp"
+
+namespace gps {
+
+    // Surface attributes of the visible scene for deferred shading: albedo, world normal,
+    // material (sun visibility and specular colour) and depth, one texel per pixel.
+    class GBuffer
+    {
+    public:
+        void Create(int width, int height);
+        // binds the G-buffer, sets the viewport and clears it
+        void Begin();
+        void End();
+        // draws one fullscreen triangle with the lighting shader into the bound framebuffer,
+        // the G-buffer textures are bound from unit 0 and the depth test always passes
+        void Composite(gps::Shader lightingShader);
+        void Delete();
+
+        GLuint getAlbedoTexture();
+        GLuint getNormalTexture();
+        GLuint getMaterialTexture();
+        GLuint getDepthTexture();
+
+    private:
+        int width = 0;
+        int height = 0;
+        GLuint framebuffer = 0;
+        GLuint albedoTexture = 0;
+        GLuint normalTexture = 0;
+        GLuint materialTexture = 0;
+        GLuint depthTexture = 0;
+        GLuint emptyVAO = 0;
+
+        GLuint CreateTarget(GLint internalFormat, GLenum format, GLenum type);
+    };
+
+}
+
+#endif /* GBuffer_hpp */
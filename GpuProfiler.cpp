@@ -0,0 +1,192 @@
+#include "GpuProfiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    void GpuProfiler::Create(int historyFrames)
+    {
+        this->historyFrames = historyFrames;
+    }
+
+    GLuint GpuProfiler::NextQuery(FrameQueries& frame)
+    {
+        if (frame.usedQueries == (int)frame.queryPool.size()) {
+            GLuint query;
+            glGenQueries(1, &query);
+            frame.queryPool.push_back(query);
+        }
+        return frame.queryPool[frame.usedQueries++];
+    }
+
+    void GpuProfiler::BeginFrame()
+    {
+        // results arrive in submission order, so a frame is done once its last timestamp is
+        for (int i = 1; i <= frameLatency; i++) {
+            FrameQueries& frame = frames[(frameIndex + i) % frameLatency];
+            if (!frame.pending)
+                continue;
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(frame.queryPool[frame.usedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+            ReadFrame(frame);
+        }
+
+        frameIndex = (frameIndex + 1) % frameLatency;
+        FrameQueries& frame = frames[frameIndex];
+        if (frame.pending) {
+            droppedFrames++;
+            frame.pending = false;
+        }
+        frame.usedQueries = 0;
+        frame.scopes.clear();
+        openScopes.clear();
+        currentPath.clear();
+        recording = true;
+    }
+
+    void GpuProfiler::EndFrame()
+    {
+        // scopes left open have no end timestamp and are ignored
+        FrameQueries& frame = frames[frameIndex];
+        frame.pending = frame.usedQueries > 0;
+        recording = false;
+    }
+
+    void GpuProfiler::Begin(const std::string& name)
+    {
+        if (!recording)
+            return;
+
+        std::string path = currentPath.empty() ? name : currentPath + "/" + name;
+        std::map<std::string, int>::iterator found = scopeIndices.find(path);
+        int scope;
+        if (found == scopeIndices.end()) {
+            scope = (int)scopes.size();
+            ScopeHistory history;
+            history.path = path;
+            history.depth = (int)openScopes.size();
+            history.samples.assign(historyFrames, 0.0f);
+            scopes.push_back(history);
+            scopeIndices[path] = scope;
+        }
+        else {
+            scope = found->second;
+        }
+
+        FrameQueries& frame = frames[frameIndex];
+        ScopeQueries queries;
+        queries.scope = scope;
+        queries.beginQuery = NextQuery(frame);
+        queries.endQuery = 0;
+        glQueryCounter(queries.beginQuery, GL_TIMESTAMP);
+        openScopes.push_back((int)frame.scopes.size());
+        frame.scopes.push_back(queries);
+        currentPath = path;
+    }
+
+    void GpuProfiler::End()
+    {
+        if (!recording || openScopes.empty())
+            return;
+
+        FrameQueries& frame = frames[frameIndex];
+        ScopeQueries& queries = frame.scopes[openScopes.back()];
+        queries.endQuery = NextQuery(frame);
+        glQueryCounter(queries.endQuery, GL_TIMESTAMP);
+        openScopes.pop_back();
+        currentPath = openScopes.empty() ? std::string() : scopes[frame.scopes[openScopes.back()].scope].path;
+    }
+
+    void GpuProfiler::ReadFrame(FrameQueries& frame)
+    {
+        // a scope entered several times in a frame adds up to one sample
+        std::vector<double> frameMs(scopes.size(), -1.0);
+        for (size_t i = 0; i < frame.scopes.size(); i++) {
+            ScopeQueries& queries = frame.scopes[i];
+            if (queries.endQuery == 0)
+                continue;
+            GLuint64 beginTime = 0;
+            GLuint64 endTime = 0;
+            glGetQueryObjectui64v(queries.beginQuery, GL_QUERY_RESULT, &beginTime);
+            glGetQueryObjectui64v(queries.endQuery, GL_QUERY_RESULT, &endTime);
+            double ms = endTime > beginTime ? (endTime - beginTime) / 1000000.0 : 0.0;
+            frameMs[queries.scope] = std::max(frameMs[queries.scope], 0.0) + ms;
+        }
+
+        for (size_t i = 0; i < scopes.size(); i++) {
+            if (frameMs[i] < 0.0)
+                continue;
+            ScopeHistory& scope = scopes[i];
+            scope.lastMs = (float)frameMs[i];
+            scope.samples[scope.nextSample] = scope.lastMs;
+            scope.nextSample = (scope.nextSample + 1) % historyFrames;
+            scope.sampleCount = std::min(scope.sampleCount + 1, historyFrames);
+        }
+        frame.pending = false;
+    }
+
+    GpuScopeStats GpuProfiler::ComputeStats(ScopeHistory& scope)
+    {
+        GpuScopeStats stats = {};
+        stats.path = scope.path;
+        stats.depth = scope.depth;
+        stats.sampleCount = scope.sampleCount;
+        stats.lastMs = scope.lastMs;
+        if (scope.sampleCount == 0)
+            return stats;
+
+        std::vector<float> sorted(scope.samples.begin(), scope.samples.begin() + scope.sampleCount);
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (float sample : sorted) {
+            total += sample;
+        }
+        stats.averageMs = (float)(total / sorted.size());
+        stats.minMs = sorted.front();
+        stats.maxMs = sorted.back();
+        int p99Index = (int)std::ceil(0.99 * sorted.size()) - 1;
+        stats.p99Ms = sorted[std::max(p99Index, 0)];
+        return stats;
+    }
+
+    bool GpuProfiler::getStats(const std::string& path, GpuScopeStats& stats)
+    {
+        std::map<std::string, int>::iterator found = scopeIndices.find(path);
+        if (found == scopeIndices.end() || scopes[found->second].sampleCount == 0)
+            return false;
+        stats = ComputeStats(scopes[found->second]);
+        return true;
+    }
+
+    std::vector<GpuScopeStats> GpuProfiler::getAllStats()
+    {
+        std::vector<GpuScopeStats> allStats;
+        for (ScopeHistory& scope : scopes) {
+            allStats.push_back(ComputeStats(scope));
+        }
+        return allStats;
+    }
+
+    int GpuProfiler::getDroppedFrames()
+    {
+        return droppedFrames;
+    }
+
+    void GpuProfiler::Delete()
+    {
+        for (FrameQueries& frame : frames) {
+            if (!frame.queryPool.empty())
+                glDeleteQueries((GLsizei)frame.queryPool.size(), frame.queryPool.data());
+            frame.queryPool.clear();
+            frame.usedQueries = 0;
+            frame.scopes.clear();
+            frame.pending = false;
+        }
+        scopes.clear();
+        scopeIndices.clear();
+    }
+
+}
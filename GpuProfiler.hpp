@@ -0,0 +1,89 @@
+#ifndef GpuProfiler_hpp
+#define GpuProfiler_hpp
+
+#include <GL/glew.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // timings of one scope over the last frames, in milliseconds
+    struct GpuScopeStats {
+        // names of the enclosing scopes and the scope, joined by '/'
+        std::string path;
+        int depth;
+        int sampleCount;
+        float lastMs;
+        float averageMs;
+        float minMs;
+        float maxMs;
+        float p99Ms;
+    };
+
+    // GPU time of named scopes, which may nest. Each Begin and End writes a GL_TIMESTAMP, the
+    // queries of a frame go to one slot of a ring a few frames deep and are only read once the
+    // GPU has written them, so the CPU never waits for the GPU. A frame whose results are still
+    // pending when its slot comes around again is dropped.
+    class GpuProfiler
+    {
+    public:
+        // historyFrames samples per scope are kept for the statistics
+        void Create(int historyFrames);
+        // reads back the finished frames, then starts recording a new one
+        void BeginFrame();
+        void EndFrame();
+        void Begin(const std::string& name);
+        void End();
+        void Delete();
+
+        // false when the scope has no finished sample yet
+        bool getStats(const std::string& path, GpuScopeStats& stats);
+        // every scope seen so far, in the order they first ran
+        std::vector<GpuScopeStats> getAllStats();
+        int getDroppedFrames();
+
+    private:
+        static const int frameLatency = 4;
+
+        struct ScopeQueries {
+            int scope;
+            GLuint beginQuery;
+            GLuint endQuery;
+        };
+        struct FrameQueries {
+            std::vector<GLuint> queryPool;
+            int usedQueries = 0;
+            std::vector<ScopeQueries> scopes;
+            bool pending = false;
+        };
+        struct ScopeHistory {
+            std::string path;
+            int depth;
+            // ring of the last samples
+            std::vector<float> samples;
+            int nextSample = 0;
+            int sampleCount = 0;
+            float lastMs = 0.0f;
+        };
+
+        int historyFrames = 0;
+        FrameQueries frames[frameLatency];
+        int frameIndex = 0;
+        bool recording = false;
+        std::vector<ScopeHistory> scopes;
+        std::map<std::string, int> scopeIndices;
+        // scopes begun and not ended yet, as indices into the current frame's scopes
+        std::vector<int> openScopes;
+        std::string currentPath;
+        int droppedFrames = 0;
+
+        GLuint NextQuery(FrameQueries& frame);
+        void ReadFrame(FrameQueries& frame);
+        GpuScopeStats ComputeStats(ScopeHistory& scope);
+    };
+
+}
+
+#endif /* GpuProfiler_hpp */
@@ -0,0 +1,195 @@
+#include "InputLog.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+namespace gps {
+
+    namespace {
+
+        // version 2 added the settings after the cursor: int32 width and height, then uint8
+        // deferred, depth pre-pass and night
+        const char inputLogMagic[4] = { 'I', 'N', 'P', '2' };
+        const char inputLogMagicV1[4] = { 'I', 'N', 'P', '1' };
+
+        // record types on disk, each followed by the frame as uint32
+        // key: int16 key, int32 scancode, uint8 action, uint8 mods
+        // cursor: two doubles, end: nothing, the frame is the frame count
+        const uint8_t RECORD_KEY = 0;
+        const uint8_t RECORD_CURSOR = 1;
+        const uint8_t RECORD_END = 2;
+
+        template <typename T>
+        void writeValue(std::ofstream& file, T value)
+        {
+            file.write((const char*)&value, sizeof(value));
+        }
+
+        template <typename T>
+        bool readValue(std::ifstream& file, T& value)
+        {
+            return (bool)file.read((char*)&value, sizeof(value));
+        }
+
+    }
+
+    bool InputLog::BeginRecording(std::string fileName, double cursorX, double cursorY, const InputSettings& settings)
+    {
+        recordFile.open(fileName.c_str(), std::ios::binary);
+        if (!recordFile) {
+            std::cerr << "ERROR: could not write " << fileName << std::endl;
+            return false;
+        }
+        recordFile.write(inputLogMagic, sizeof(inputLogMagic));
+        writeValue(recordFile, cursorX);
+        writeValue(recordFile, cursorY);
+        writeValue(recordFile, (int32_t)settings.width);
+        writeValue(recordFile, (int32_t)settings.height);
+        writeValue(recordFile, (uint8_t)settings.deferred);
+        writeValue(recordFile, (uint8_t)settings.depthPrepass);
+        writeValue(recordFile, (uint8_t)settings.night);
+        return true;
+    }
+
+    void InputLog::addKey(int frame, int key, int scancode, int action, int mods)
+    {
+        writeValue(recordFile, RECORD_KEY);
+        writeValue(recordFile, (uint32_t)frame);
+        writeValue(recordFile, (int16_t)key);
+        writeValue(recordFile, (int32_t)scancode);
+        writeValue(recordFile, (uint8_t)action);
+        writeValue(recordFile, (uint8_t)mods);
+    }
+
+    void InputLog::addCursor(int frame, double x, double y)
+    {
+        writeValue(recordFile, RECORD_CURSOR);
+        writeValue(recordFile, (uint32_t)frame);
+        writeValue(recordFile, x);
+        writeValue(recordFile, y);
+    }
+
+    void InputLog::EndRecording(int frameCount)
+    {
+        writeValue(recordFile, RECORD_END);
+        writeValue(recordFile, (uint32_t)frameCount);
+        recordFile.close();
+    }
+
+    bool InputLog::isRecording()
+    {
+        return recordFile.is_open();
+    }
+
+    bool InputLog::Load(std::string fileName)
+    {
+        std::ifstream file(fileName.c_str(), std::ios::binary);
+        if (!file) {
+            std::cerr << "ERROR: could not read " << fileName << std::endl;
+            return false;
+        }
+
+        char magic[4];
+        file.read(magic, sizeof(magic));
+        if (file && memcmp(magic, inputLogMagicV1, sizeof(magic)) == 0) {
+            std::cerr << "ERROR: " << fileName << " was recorded without its startup settings, record it again" << std::endl;
+            return false;
+        }
+        if (!file || memcmp(magic, inputLogMagic, sizeof(magic)) != 0) {
+            std::cerr << "ERROR: " << fileName << " is not an input log" << std::endl;
+            return false;
+        }
+        int32_t width;
+        int32_t height;
+        uint8_t deferred;
+        uint8_t depthPrepass;
+        uint8_t night;
+        if (!readValue(file, startCursorX) || !readValue(file, startCursorY) || !readValue(file, width) ||
+            !readValue(file, height) || !readValue(file, deferred) || !readValue(file, depthPrepass) || !readValue(file, night)) {
+            std::cerr << "ERROR: " << fileName << " has a truncated header" << std::endl;
+            return false;
+        }
+        settings.width = width;
+        settings.height = height;
+        settings.deferred = deferred != 0;
+        settings.depthPrepass = depthPrepass != 0;
+        settings.night = night != 0;
+
+        events.clear();
+        nextEventIndex = 0;
+        frameCount = 0;
+        uint8_t type;
+        uint32_t frame;
+        while (readValue(file, type) && readValue(file, frame)) {
+            if (type == RECORD_END) {
+                frameCount = (int)frame;
+                return true;
+            }
+
+            InputEvent event = {};
+            event.frame = (int)frame;
+            if (type == RECORD_KEY) {
+                int16_t key;
+                int32_t scancode;
+                uint8_t action;
+                uint8_t mods;
+                if (!readValue(file, key) || !readValue(file, scancode) || !readValue(file, action) || !readValue(file, mods))
+                    break;
+                event.type = INPUT_KEY;
+                event.key = key;
+                event.scancode = scancode;
+                event.action = action;
+                event.mods = mods;
+            }
+            else if (type == RECORD_CURSOR) {
+                event.type = INPUT_CURSOR;
+                if (!readValue(file, event.x) || !readValue(file, event.y))
+                    break;
+            }
+            else {
+                std::cerr << "ERROR: " << fileName << " has an unknown record" << std::endl;
+                break;
+            }
+            events.push_back(event);
+        }
+
+        // cut short, the session ends after the frame of the last event
+        frameCount = events.empty() ? 0 : events.back().frame + 1;
+        return true;
+    }
+
+    bool InputLog::nextEvent(int frame, InputEvent& event)
+    {
+        if (nextEventIndex >= events.size() || events[nextEventIndex].frame != frame)
+            return false;
+        event = events[nextEventIndex++];
+        return true;
+    }
+
+    int InputLog::getFrameCount()
+    {
+        return frameCount;
+    }
+
+    int InputLog::getEventCount()
+    {
+        return (int)events.size();
+    }
+
+    double InputLog::getStartCursorX()
+    {
+        return startCursorX;
+    }
+
+    double InputLog::getStartCursorY()
+    {
+        return startCursorY;
+    }
+
+    InputSettings InputLog::getSettings()
+    {
+        return settings;
+    }
+
+}
@@ -0,0 +1,68 @@
+#ifndef InputLog_hpp
+#define InputLog_hpp
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    enum INPUT_EVENT { INPUT_KEY, INPUT_CURSOR };
+
+    // a key or cursor event as GLFW delivered it, during the polling of the given frame
+    struct InputEvent {
+        int frame;
+        INPUT_EVENT type;
+        int key;
+        int scancode;
+        int action;
+        int mods;
+        double x;
+        double y;
+    };
+
+    // the startup settings the events were recorded under, a replay has to start from the same
+    struct InputSettings {
+        int width;
+        int height;
+        bool deferred;
+        bool depthPrepass;
+        bool night;
+    };
+
+    // Keyboard and cursor events of a session with the frame they arrived in, so the session can
+    // be fed back frame by frame. The binary log holds the starting cursor position and settings,
+    // then one packed record per event and an end record with the frame count; a log cut short by
+    // a crash ends after its last event.
+    class InputLog
+    {
+    public:
+        // events are written as they arrive
+        bool BeginRecording(std::string fileName, double cursorX, double cursorY, const InputSettings& settings);
+        void addKey(int frame, int key, int scancode, int action, int mods);
+        void addCursor(int frame, double x, double y);
+        void EndRecording(int frameCount);
+        bool isRecording();
+
+        bool Load(std::string fileName);
+        // the next event polled in the given frame, false once the frame has no more
+        bool nextEvent(int frame, InputEvent& event);
+        int getFrameCount();
+        int getEventCount();
+        double getStartCursorX();
+        double getStartCursorY();
+        InputSettings getSettings();
+
+    private:
+        std::ofstream recordFile;
+        std::vector<InputEvent> events;
+        size_t nextEventIndex = 0;
+        int frameCount = 0;
+        double startCursorX = 0.0;
+        double startCursorY = 0.0;
+        InputSettings settings = {};
+    };
+
+}
+
+#endif /* InputLog_hpp */
@@ -0,0 +1,319 @@
+#include "LightClusters.hpp"
+#include "RenderStats.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+namespace gps {
+
+    void LightClusters::Create(int tilesX, int tilesY, int slices, glm::mat4 projection)
+    {
+        this->tilesX = tilesX;
+        this->tilesY = tilesY;
+        this->slices = slices;
+        //planes of a perspective matrix, z' = (a * z + b) / -z with a = [2][2] and b = [3][2]
+        nearDepth = projection[3][2] / (projection[2][2] - 1.0f);
+        farDepth = projection[3][2] / (projection[2][2] + 1.0f);
+
+        //exponential slices, each one covers the same ratio of depths
+        sliceDepths.resize(slices + 1);
+        for (int i = 0; i <= slices; i++) {
+            sliceDepths[i] = nearDepth * std::pow(farDepth / nearDepth, (float)i / slices);
+        }
+        sliceBins.resize(slices);
+
+        glGenBuffers(1, &lightBuffer);
+        glGenTextures(1, &lightTexture);
+        glGenBuffers(1, &gridBuffer);
+        glGenTextures(1, &gridTexture);
+        glGenBuffers(1, &indexBuffer);
+        glGenTextures(1, &indexTexture);
+
+        //the main thread bins slices too
+        unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int i = 1; i < threadCount; i++) {
+            workers.push_back(std::thread(&LightClusters::WorkerLoop, this));
+        }
+    }
+
+    void LightClusters::WorkerLoop()
+    {
+        int seenGeneration = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                startCondition.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+                if (stopping)
+                    return;
+                seenGeneration = generation;
+            }
+
+            BinSlices();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pendingWorkers == 0) {
+                doneCondition.notify_one();
+            }
+        }
+    }
+
+    void LightClusters::Update(const std::vector<ClusterLight>& lights, glm::mat4 view, glm::mat4 projection, int viewportWidth, int viewportHeight)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        tileWidth = (viewportWidth + tilesX - 1) / tilesX;
+        tileHeight = (viewportHeight + tilesY - 1) / tilesY;
+        projectionScale = glm::vec2(projection[0][0], projection[1][1]);
+        // ndc to tile coordinates, scale and offset are the same value
+        ndcToTile = glm::vec2(0.5f * viewportWidth / tileWidth, 0.5f * viewportHeight / tileHeight);
+
+        //view space positions, the padding never overlaps a slice
+        lightCount = (int)lights.size();
+        paddedLightCount = (lightCount + 3) & ~3;
+        lightX.assign(paddedLightCount, 0.0f);
+        lightY.assign(paddedLightCount, 0.0f);
+        lightDepth.assign(paddedLightCount, -1.0e30f);
+        lightRange.assign(paddedLightCount, 0.0f);
+        lightData.resize(lightCount * 16);
+        for (int i = 0; i < lightCount; i++) {
+            const ClusterLight& light = lights[i];
+            glm::vec4 viewPosition = view * glm::vec4(light.position, 1.0f);
+            lightX[i] = viewPosition.x;
+            lightY[i] = viewPosition.y;
+            lightDepth[i] = -viewPosition.z;
+            lightRange[i] = light.range;
+
+            GLfloat* data = &lightData[i * 16];
+            data[0] = light.position.x;
+            data[1] = light.position.y;
+            data[2] = light.position.z;
+            data[3] = light.range;
+            data[4] = light.color.x;
+            data[5] = light.color.y;
+            data[6] = light.color.z;
+            data[7] = light.outerCutoff;
+            data[8] = light.direction.x;
+            data[9] = light.direction.y;
+            data[10] = light.direction.z;
+            data[11] = light.innerCutoff;
+            data[12] = (float)light.shadowIndex;
+            data[13] = 0.0f;
+            data[14] = 0.0f;
+            data[15] = 0.0f;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            nextSlice = 0;
+            pendingWorkers = (int)workers.size();
+            generation++;
+        }
+        startCondition.notify_all();
+        BinSlices();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            doneCondition.wait(lock, [&]() { return pendingWorkers == 0; });
+        }
+
+        //slices are stored one after another, so a cluster's offset is its slice's start plus its own
+        int clustersPerSlice = tilesX * tilesY;
+        gridData.resize(slices * clustersPerSlice * 2);
+        indexData.clear();
+        maxLightsPerCluster = 0;
+        for (int slice = 0; slice < slices; slice++) {
+            SliceBins& bins = sliceBins[slice];
+            uint32_t sliceStart = (uint32_t)indexData.size();
+            for (int cluster = 0; cluster < clustersPerSlice; cluster++) {
+                gridData[(slice * clustersPerSlice + cluster) * 2] = sliceStart + bins.offsets[cluster];
+                gridData[(slice * clustersPerSlice + cluster) * 2 + 1] = bins.counts[cluster];
+                maxLightsPerCluster = std::max(maxLightsPerCluster, (int)bins.counts[cluster]);
+            }
+            indexData.insert(indexData.end(), bins.indices.begin(), bins.indices.end());
+        }
+
+        Upload();
+
+        binningMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void LightClusters::BinSlices()
+    {
+        int slice;
+        while ((slice = nextSlice++) < slices) {
+            BinSlice(slice);
+        }
+    }
+
+    void LightClusters::BinSlice(int slice)
+    {
+        SliceBins& bins = sliceBins[slice];
+        bins.ranges.clear();
+
+        __m128 sliceNear = _mm_set1_ps(sliceDepths[slice]);
+        __m128 sliceFar = _mm_set1_ps(sliceDepths[slice + 1]);
+        __m128 scaleX = _mm_set1_ps(projectionScale.x);
+        __m128 scaleY = _mm_set1_ps(projectionScale.y);
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 minusOne = _mm_set1_ps(-1.0f);
+        __m128 tileScaleX = _mm_set1_ps(ndcToTile.x);
+        __m128 tileScaleY = _mm_set1_ps(ndcToTile.y);
+        __m128 zero = _mm_setzero_ps();
+        __m128 lastTileX = _mm_set1_ps((float)(tilesX - 1));
+        __m128 lastTileY = _mm_set1_ps((float)(tilesY - 1));
+
+        alignas(16) int minX[4], maxX[4], minY[4], maxY[4];
+        for (int i = 0; i < paddedLightCount; i += 4) {
+            __m128 depth = _mm_loadu_ps(&lightDepth[i]);
+            __m128 range = _mm_loadu_ps(&lightRange[i]);
+            __m128 minDepth = _mm_sub_ps(depth, range);
+            __m128 maxDepth = _mm_add_ps(depth, range);
+            __m128 overlap = _mm_and_ps(_mm_cmplt_ps(minDepth, sliceFar), _mm_cmpgt_ps(maxDepth, sliceNear));
+            if (_mm_movemask_ps(overlap) == 0)
+                continue;
+
+            //the part of the light's box inside the slice projects between its nearest and farthest depth
+            __m128 inverseNear = _mm_div_ps(one, _mm_max_ps(minDepth, sliceNear));
+            __m128 inverseFar = _mm_div_ps(one, _mm_min_ps(maxDepth, sliceFar));
+            __m128 x = _mm_loadu_ps(&lightX[i]);
+            __m128 y = _mm_loadu_ps(&lightY[i]);
+            __m128 left = _mm_sub_ps(x, range);
+            __m128 right = _mm_add_ps(x, range);
+            __m128 bottom = _mm_sub_ps(y, range);
+            __m128 top = _mm_add_ps(y, range);
+            __m128 ndcMinX = _mm_mul_ps(_mm_min_ps(_mm_mul_ps(left, inverseNear), _mm_mul_ps(left, inverseFar)), scaleX);
+            __m128 ndcMaxX = _mm_mul_ps(_mm_max_ps(_mm_mul_ps(right, inverseNear), _mm_mul_ps(right, inverseFar)), scaleX);
+            __m128 ndcMinY = _mm_mul_ps(_mm_min_ps(_mm_mul_ps(bottom, inverseNear), _mm_mul_ps(bottom, inverseFar)), scaleY);
+            __m128 ndcMaxY = _mm_mul_ps(_mm_max_ps(_mm_mul_ps(top, inverseNear), _mm_mul_ps(top, inverseFar)), scaleY);
+
+            //lights beside the frustum are dropped
+            overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmpge_ps(ndcMaxX, minusOne), _mm_cmple_ps(ndcMinX, one)));
+            overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmpge_ps(ndcMaxY, minusOne), _mm_cmple_ps(ndcMinY, one)));
+            int mask = _mm_movemask_ps(overlap);
+            if (mask == 0)
+                continue;
+
+            //ndc to tiles, clamped to the grid before truncating
+            _mm_store_si128((__m128i*)minX, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(ndcMinX, tileScaleX), tileScaleX), zero), lastTileX)));
+            _mm_store_si128((__m128i*)maxX, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(ndcMaxX, tileScaleX), tileScaleX), zero), lastTileX)));
+            _mm_store_si128((__m128i*)minY, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(ndcMinY, tileScaleY), tileScaleY), zero), lastTileY)));
+            _mm_store_si128((__m128i*)maxY, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(ndcMaxY, tileScaleY), tileScaleY), zero), lastTileY)));
+            for (int lane = 0; lane < 4; lane++) {
+                if (mask & (1 << lane)) {
+                    TileRange tileRange = { i + lane, minX[lane], maxX[lane], minY[lane], maxY[lane] };
+                    bins.ranges.push_back(tileRange);
+                }
+            }
+        }
+
+        //counting sort of the light indices by cluster
+        int clustersPerSlice = tilesX * tilesY;
+        bins.counts.assign(clustersPerSlice, 0);
+        for (const TileRange& tileRange : bins.ranges) {
+            for (int tileY = tileRange.minY; tileY <= tileRange.maxY; tileY++) {
+                for (int tileX = tileRange.minX; tileX <= tileRange.maxX; tileX++) {
+                    bins.counts[tileY * tilesX + tileX]++;
+                }
+            }
+        }
+        bins.offsets.resize(clustersPerSlice);
+        uint32_t total = 0;
+        for (int cluster = 0; cluster < clustersPerSlice; cluster++) {
+            bins.offsets[cluster] = total;
+            total += bins.counts[cluster];
+        }
+        bins.indices.resize(total);
+        std::vector<uint32_t> cursors(bins.offsets);
+        for (const TileRange& tileRange : bins.ranges) {
+            for (int tileY = tileRange.minY; tileY <= tileRange.maxY; tileY++) {
+                for (int tileX = tileRange.minX; tileX <= tileRange.maxX; tileX++) {
+                    bins.indices[cursors[tileY * tilesX + tileX]++] = (uint32_t)tileRange.light;
+                }
+            }
+        }
+    }
+
+    void LightClusters::Upload()
+    {
+        //buffers are orphaned every frame, the previous frame may still read them
+        glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(lightData.size(), 4) * sizeof(GLfloat), lightData.empty() ? NULL : lightData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, gridData.size() * sizeof(uint32_t), gridData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(indexData.size(), 1) * sizeof(uint32_t), indexData.empty() ? NULL : indexData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void LightClusters::Bind(gps::Shader shader, int firstUnit)
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterLightData"), firstUnit);
+
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+        glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, gridBuffer);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterGrid"), firstUnit + 1);
+
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
+        glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indexBuffer);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterLightIndices"), firstUnit + 2);
+        RenderStats::countTextureBinds(3);
+
+        //slice = log(depth) * scale + bias
+        float depthScale = slices / std::log(farDepth / nearDepth);
+        glUniform3i(glGetUniformLocation(shader.shaderProgram, "clusterCount"), tilesX, tilesY, slices);
+        glUniform2f(glGetUniformLocation(shader.shaderProgram, "clusterTileSize"), (float)tileWidth, (float)tileHeight);
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "clusterDepthScale"), depthScale);
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "clusterDepthBias"), -std::log(nearDepth) * depthScale);
+    }
+
+    void LightClusters::Delete()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        startCondition.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+        workers.clear();
+
+        if (lightBuffer) {
+            glDeleteTextures(1, &lightTexture);
+            glDeleteBuffers(1, &lightBuffer);
+            glDeleteTextures(1, &gridTexture);
+            glDeleteBuffers(1, &gridBuffer);
+            glDeleteTextures(1, &indexTexture);
+            glDeleteBuffers(1, &indexBuffer);
+            lightBuffer = 0;
+        }
+    }
+
+    int LightClusters::getLightCount()
+    {
+        return lightCount;
+    }
+
+    int LightClusters::getIndexCount()
+    {
+        return (int)indexData.size();
+    }
+
+    int LightClusters::getMaxLightsPerCluster()
+    {
+        return maxLightsPerCluster;
+    }
+
+    float LightClusters::getBinningMs()
+    {
+        return binningMs;
+    }
+
+}
@@ -0,0 +1,118 @@
+#ifndef LightClusters_hpp
+#define LightClusters_hpp
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    struct ClusterLight {
+        glm::vec3 position;
+        float range;
+        glm::vec3 color;
+        glm::vec3 direction;
+        // cosines of the cone angles, a point light has an outer cutoff of -1
+        float innerCutoff;
+        float outerCutoff;
+        // street lamp shadow to sample, -1 for none
+        int shadowIndex;
+    };
+
+    // Clustered forward lighting: the camera frustum is split into screen tiles and exponential
+    // depth slices, and every cluster gets the list of lights reaching it. The lists are built
+    // on the CPU each frame, four lights at a time with SSE and one depth slice per worker, and
+    // handed to the fragment shader as buffer textures.
+    class LightClusters
+    {
+    public:
+        // the depth slices span the near and far planes of the perspective projection
+        void Create(int tilesX, int tilesY, int slices, glm::mat4 projection);
+        // bins the lights into the clusters of the camera frustum
+        void Update(const std::vector<ClusterLight>& lights, glm::mat4 view, glm::mat4 projection, int viewportWidth, int viewportHeight);
+        // binds the light data, cluster grid and light index buffers to three units from firstUnit
+        void Bind(gps::Shader shader, int firstUnit);
+        void Delete();
+
+        int getLightCount();
+        int getIndexCount();
+        int getMaxLightsPerCluster();
+        float getBinningMs();
+
+    private:
+        // lights overlapping a slice, with the tiles they cover
+        struct TileRange {
+            int light;
+            int minX;
+            int maxX;
+            int minY;
+            int maxY;
+        };
+
+        struct SliceBins {
+            std::vector<TileRange> ranges;
+            std::vector<uint32_t> counts;
+            std::vector<uint32_t> offsets;
+            std::vector<uint32_t> indices;
+        };
+
+        int tilesX = 0;
+        int tilesY = 0;
+        int slices = 0;
+        float nearDepth = 0.0f;
+        float farDepth = 0.0f;
+        std::vector<float> sliceDepths;
+        int tileWidth = 1;
+        int tileHeight = 1;
+        glm::vec2 projectionScale;
+        glm::vec2 ndcToTile;
+
+        // view space lights, one array per component, padded to a multiple of four
+        std::vector<float> lightX;
+        std::vector<float> lightY;
+        std::vector<float> lightDepth;
+        std::vector<float> lightRange;
+        int lightCount = 0;
+        int paddedLightCount = 0;
+
+        std::vector<SliceBins> sliceBins;
+        std::vector<GLfloat> lightData;
+        std::vector<uint32_t> gridData;
+        std::vector<uint32_t> indexData;
+        int maxLightsPerCluster = 0;
+        float binningMs = 0.0f;
+
+        GLuint lightBuffer = 0;
+        GLuint lightTexture = 0;
+        GLuint gridBuffer = 0;
+        GLuint gridTexture = 0;
+        GLuint indexBuffer = 0;
+        GLuint indexTexture = 0;
+
+        // workers stay alive between frames and wait for the next generation of work
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable startCondition;
+        std::condition_variable doneCondition;
+        int generation = 0;
+        int pendingWorkers = 0;
+        bool stopping = false;
+        std::atomic<int> nextSlice;
+
+        void WorkerLoop();
+        void BinSlices();
+        void BinSlice(int slice);
+        void Upload();
+    };
+
+}
+
+#endif /* LightClusters_hpp */
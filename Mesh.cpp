@@ -1,4 +1,9 @@
 #include "Mesh.hpp"
+#include "RenderStats.hpp"
+
+#include <cstring>
+#include <unordered_map>
+
 namespace gps {
 
 	/* Mesh Constructor */
@@ -7,6 +12,7 @@ namespace gps {
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->materialProgram = 0;
 
 		this->setupMesh();
 	}
@@ -15,21 +21,41 @@ namespace gps {
 	    return this->buffers;
 	}
 
+	BoundingBox Mesh::getBounds() {
+	    return this->bounds;
+	}
+
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)
+	void Mesh::Draw(gps::Shader shader, DRAW_MODE mode)
 	{
-		shader.useShaderProgram();
+		if (mode == DRAW_DEPTH_ONLY) {
+			// depth programs sample no textures, only geometry is submitted
+			glBindVertexArray(this->buffers.depthVAO);
+			glDrawElements(GL_TRIANGLES, this->depthIndexCount, GL_UNSIGNED_INT, 0);
+			RenderStats::countDraw(GL_TRIANGLES, this->depthIndexCount);
+			glBindVertexArray(0);
+			return;
+		}
+
+		if (this->materialProgram != shader.shaderProgram) {
+			this->materialProgram = shader.shaderProgram;
+			this->textureLocations.clear();
+			for (GLuint i = 0; i < textures.size(); i++)
+				this->textureLocations.push_back(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()));
+		}
 
 		//set textures
 		for (GLuint i = 0; i < textures.size(); i++)
 		{
 			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
+			glUniform1i(this->textureLocations[i], i);
 			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
 		}
+		RenderStats::countTextureBinds((int)textures.size());
 
 		glBindVertexArray(this->buffers.VAO);
 		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
+		RenderStats::countDraw(GL_TRIANGLES, (GLsizei)this->indices.size());
 		glBindVertexArray(0);
 
         for(GLuint i = 0; i < this->textures.size(); i++)
@@ -37,11 +63,24 @@ namespace gps {
             glActiveTexture(GL_TEXTURE0 + i);
             glBindTexture(GL_TEXTURE_2D, 0);
         }
+        RenderStats::countTextureBinds((int)this->textures.size());
 
     }
 
 	// Initializes all the buffer objects/arrays
 	void Mesh::setupMesh(){
+		// Compute the bounding box used for culling
+		this->bounds.min = glm::vec3(0.0f);
+		this->bounds.max = glm::vec3(0.0f);
+		if (!this->vertices.empty()) {
+			this->bounds.min = this->vertices[0].Position;
+			this->bounds.max = this->vertices[0].Position;
+		}
+		for (size_t i = 1; i < this->vertices.size(); i++) {
+			this->bounds.min = glm::min(this->bounds.min, this->vertices[i].Position);
+			this->bounds.max = glm::max(this->bounds.max, this->vertices[i].Position);
+		}
+
 		// Create buffers/arrays
 		glGenVertexArrays(1, &this->buffers.VAO);
 		glGenBuffers(1, &this->buffers.VBO);
@@ -67,5 +106,69 @@ namespace gps {
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
 
 		glBindVertexArray(0);
+
+		this->setupDepthMesh();
+	}
+
+	namespace {
+		struct PositionKey {
+			unsigned int bits[3];
+
+			bool operator==(const PositionKey& other) const {
+				return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+			}
+		};
+
+		struct PositionKeyHash {
+			size_t operator()(const PositionKey& key) const {
+				return (key.bits[0] * 73856093u) ^ (key.bits[1] * 19349663u) ^ (key.bits[2] * 83492791u);
+			}
+		};
+	}
+
+	// Builds the de-interleaved, welded position stream
+	void Mesh::setupDepthMesh(){
+		// vertices that only differ by normal or texture coordinates collapse into one position,
+		// compared bit for bit so depth stays identical to the full vertex stream
+		std::vector<glm::vec3> positions;
+		std::vector<GLuint> depthIndices;
+		std::unordered_map<PositionKey, GLuint, PositionKeyHash> welded;
+		positions.reserve(this->vertices.size());
+		depthIndices.reserve(this->indices.size());
+
+		for (size_t i = 0; i < this->indices.size(); i++) {
+			const glm::vec3& position = this->vertices[this->indices[i]].Position;
+			PositionKey key;
+			memcpy(key.bits, &position, sizeof(key.bits));
+
+			std::unordered_map<PositionKey, GLuint, PositionKeyHash>::iterator found = welded.find(key);
+			if (found == welded.end()) {
+				GLuint index = (GLuint)positions.size();
+				welded[key] = index;
+				positions.push_back(position);
+				depthIndices.push_back(index);
+			}
+			else {
+				depthIndices.push_back(found->second);
+			}
+		}
+		this->depthIndexCount = (GLsizei)depthIndices.size();
+
+		glGenVertexArrays(1, &this->buffers.depthVAO);
+		glGenBuffers(1, &this->buffers.positionVBO);
+		glGenBuffers(1, &this->buffers.depthEBO);
+
+		glBindVertexArray(this->buffers.depthVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.depthEBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, depthIndices.size() * sizeof(GLuint), depthIndices.data(), GL_STATIC_DRAW);
+
+		// Vertex Positions, tightly packed
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+
+		glBindVertexArray(0);
 	}
 }
@@ -12,6 +12,9 @@
 
 namespace gps {
 
+// DRAW_FULL binds the mesh materials, DRAW_DEPTH_ONLY submits bare positions for depth passes
+enum DRAW_MODE { DRAW_FULL, DRAW_DEPTH_ONLY };
+
 struct Vertex
 {
     glm::vec3 Position;
@@ -38,6 +41,16 @@ struct Buffers {
     GLuint VAO;
     GLuint VBO;
     GLuint EBO;
+    // position only stream for the depth passes
+    GLuint depthVAO;
+    GLuint positionVBO;
+    GLuint depthEBO;
+};
+
+// Axis aligned bounding box, in the mesh's local space
+struct BoundingBox {
+    glm::vec3 min;
+    glm::vec3 max;
 };
 
 class Mesh
@@ -51,15 +64,27 @@ public:
 
 	Buffers getBuffers();
 
-	void Draw(gps::Shader shader);
+	BoundingBox getBounds();
+
+	// The shader must already be in use
+	void Draw(gps::Shader shader, DRAW_MODE mode = DRAW_FULL);
 
 private:
     /*  Render data  */
     Buffers buffers;
+    BoundingBox bounds;
+    GLsizei depthIndexCount;
+
+    // sampler locations of the textures, looked up once per program
+    GLuint materialProgram;
+    std::vector<GLint> textureLocations;
 
 	// Initializes all the buffer objects/arrays
 	void setupMesh();
 
+	// Builds the de-interleaved, welded position stream
+	void setupDepthMesh();
+
 };
 
 }
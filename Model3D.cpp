@@ -1,23 +1,57 @@
 #include "Model3D.hpp"
+#include "CpuProfiler.hpp"
 
 namespace gps {
 
 	void Model3D::LoadModel(std::string fileName)
 	{
+		PROFILE_ZONE("Model3D::LoadModel");
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
 		ReadOBJ(fileName, basePath);
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)
 	{
+		PROFILE_ZONE("Model3D::LoadModel");
 		ReadOBJ(fileName, basePath);
 	}
 
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram)
+	void Model3D::Draw(gps::Shader shaderProgram, gps::DRAW_MODE mode)
 	{
+		shaderProgram.useShaderProgram();
 		for (int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shaderProgram);
+			meshes[i].Draw(shaderProgram, mode);
+	}
+
+	void Model3D::Draw(gps::Shader shaderProgram, const std::vector<bool>& meshMask, gps::DRAW_MODE mode)
+	{
+		shaderProgram.useShaderProgram();
+		for (int i = 0; i < meshes.size(); i++)
+			if (meshMask[i])
+				meshes[i].Draw(shaderProgram, mode);
+	}
+
+	std::vector<gps::Mesh>& Model3D::getMeshes()
+	{
+		return meshes;
+	}
+
+	gps::BoundingBox Model3D::getBounds()
+	{
+		gps::BoundingBox bounds;
+		bounds.min = glm::vec3(0.0f);
+		bounds.max = glm::vec3(0.0f);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			gps::BoundingBox meshBounds = meshes[i].getBounds();
+			if (i == 0) {
+				bounds = meshBounds;
+				continue;
+			}
+			bounds.min = glm::min(bounds.min, meshBounds.min);
+			bounds.max = glm::max(bounds.max, meshBounds.max);
+		}
+		return bounds;
 	}
 
 	// Does the parsing of the .obj file and fills in the data structure
@@ -159,6 +193,7 @@ namespace gps {
 
 	// Reads the pixel data from an image file and loads it into the video memory
 	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+		PROFILE_ZONE("Model3D::ReadTextureFromFile");
 		int x, y, n;
 		int force_channels = 4;
 		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
@@ -228,6 +263,13 @@ namespace gps {
             glDeleteBuffers(1, &VBO);
             glDeleteBuffers(1, &EBO);
             glDeleteVertexArrays(1, &VAO);
+
+            GLuint positionVBO = meshes.at(i).getBuffers().positionVBO;
+            GLuint depthEBO = meshes.at(i).getBuffers().depthEBO;
+            GLuint depthVAO = meshes.at(i).getBuffers().depthVAO;
+            glDeleteBuffers(1, &positionVBO);
+            glDeleteBuffers(1, &depthEBO);
+            glDeleteVertexArrays(1, &depthVAO);
         }
 	}
 }
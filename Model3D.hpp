@@ -22,7 +22,15 @@ namespace gps {
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram);
+		void Draw(gps::Shader shaderProgram, gps::DRAW_MODE mode = gps::DRAW_FULL);
+
+		// Draws only the meshes whose flag is set
+		void Draw(gps::Shader shaderProgram, const std::vector<bool>& meshMask, gps::DRAW_MODE mode = gps::DRAW_FULL);
+
+		std::vector<gps::Mesh>& getMeshes();
+
+		// Bounding box of all the meshes, in model space
+		gps::BoundingBox getBounds();
 
     private:
 		// Component meshes - group of objects
@@ -0,0 +1,404 @@
+#include "OcclusionCuller.hpp"
+#include "RenderStats.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+namespace gps {
+
+    void OcclusionCuller::Build(gps::Model3D& model, glm::mat4 modelMatrix)
+    {
+        std::vector<gps::Mesh>& meshes = model.getMeshes();
+
+        meshBounds.clear();
+        std::vector<int> meshList;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            meshBounds.push_back(transformBoundingBox(meshes[i].getBounds(), modelMatrix));
+            meshList.push_back((int)i);
+        }
+
+        nodes.clear();
+        if (!meshList.empty()) {
+            BuildNode(meshList, 0, (int)meshList.size(), -1);
+        }
+
+        for (size_t i = 0; i < nodes.size(); i++) {
+            glGenQueries(1, &nodes[i].query);
+        }
+
+        InitBox();
+
+        std::cout << "Occlusion hierarchy: " << nodes.size() << " nodes over " << meshes.size() << " meshes" << std::endl;
+    }
+
+    int OcclusionCuller::BuildNode(std::vector<int>& meshList, int first, int count, int parent)
+    {
+        Node node;
+        node.bounds = meshBounds[meshList[first]];
+        for (int i = first + 1; i < first + count; i++) {
+            node.bounds.min = glm::min(node.bounds.min, meshBounds[meshList[i]].min);
+            node.bounds.max = glm::max(node.bounds.max, meshBounds[meshList[i]].max);
+        }
+        node.children[0] = -1;
+        node.children[1] = -1;
+        node.parent = parent;
+        node.visible = true;
+        node.tested = true;
+        node.query = 0;
+        node.queryKind = QUERY_NONE;
+        node.queryFrame = 0;
+        node.conditionalMeshCount = 0;
+
+        int nodeIndex = (int)nodes.size();
+        nodes.push_back(node);
+
+        if (count <= maxMeshesPerLeaf) {
+            for (int i = first; i < first + count; i++) {
+                nodes[nodeIndex].meshIndices.push_back(meshList[i]);
+            }
+            return nodeIndex;
+        }
+
+        // median split along the longest axis of the node
+        glm::vec3 extent = node.bounds.max - node.bounds.min;
+        int axis = 0;
+        if (extent.y > extent[axis])
+            axis = 1;
+        if (extent.z > extent[axis])
+            axis = 2;
+
+        std::vector<BoundingBox>& bounds = meshBounds;
+        std::sort(meshList.begin() + first, meshList.begin() + first + count, [&bounds, axis](int a, int b) {
+            return bounds[a].min[axis] + bounds[a].max[axis] < bounds[b].min[axis] + bounds[b].max[axis];
+        });
+
+        int half = count / 2;
+        int left = BuildNode(meshList, first, half, nodeIndex);
+        int right = BuildNode(meshList, first + half, count - half, nodeIndex);
+        nodes[nodeIndex].children[0] = left;
+        nodes[nodeIndex].children[1] = right;
+
+        return nodeIndex;
+    }
+
+    void OcclusionCuller::ReadQueryResults()
+    {
+        float latencyFrames = 0.0f;
+        float latencyMs = 0.0f;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < nodes.size(); i++) {
+            Node& node = nodes[i];
+            if (node.queryKind == QUERY_NONE)
+                continue;
+
+            // never block on a result, nodes keep last frame's visibility until it is ready
+            GLint available = 0;
+            glGetQueryObjectiv(node.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+
+            GLuint anySamplesPassed = 0;
+            glGetQueryObjectuiv(node.query, GL_QUERY_RESULT, &anySamplesPassed);
+
+            stats.resultsRead++;
+            latencyFrames += (float)(frame - node.queryFrame);
+            latencyMs += std::chrono::duration<float, std::milli>(now - node.queryTime).count();
+
+            if (node.queryKind == QUERY_HIDDEN_NODE && !anySamplesPassed) {
+                stats.savedDraws += node.conditionalMeshCount;
+            }
+
+            bool wasVisible = node.visible;
+            node.visible = anySamplesPassed != 0;
+            node.tested = true;
+            node.queryKind = QUERY_NONE;
+
+            // a hidden inner node that became visible is refined by testing its children
+            if (!wasVisible && node.visible && node.children[0] != -1) {
+                nodes[node.children[0]].tested = false;
+                nodes[node.children[1]].tested = false;
+            }
+        }
+
+        if (stats.resultsRead > 0) {
+            stats.averageLatencyFrames = latencyFrames / stats.resultsRead;
+            stats.averageLatencyMs = latencyMs / stats.resultsRead;
+        }
+
+        if (!nodes.empty()) {
+            PullUpVisibility(0);
+        }
+    }
+
+    void OcclusionCuller::PullUpVisibility(int nodeIndex)
+    {
+        Node& node = nodes[nodeIndex];
+        if (node.children[0] == -1)
+            return;
+
+        PullUpVisibility(node.children[0]);
+        PullUpVisibility(node.children[1]);
+
+        // an inner node stays open while any child is visible or still waiting for its first result
+        Node& left = nodes[node.children[0]];
+        Node& right = nodes[node.children[1]];
+        nodes[nodeIndex].visible = left.visible || !left.tested || right.visible || !right.tested;
+    }
+
+    bool OcclusionCuller::CameraInside(BoundingBox box, glm::vec3 cameraPosition)
+    {
+        // boxes crossing the near plane would be clipped and report themselves hidden
+        const float margin = 0.5f;
+        return cameraPosition.x > box.min.x - margin && cameraPosition.x < box.max.x + margin &&
+            cameraPosition.y > box.min.y - margin && cameraPosition.y < box.max.y + margin &&
+            cameraPosition.z > box.min.z - margin && cameraPosition.z < box.max.z + margin;
+    }
+
+    int OcclusionCuller::DrawLeaf(gps::Model3D& model, gps::Shader shader, Node& node)
+    {
+        std::vector<gps::Mesh>& meshes = model.getMeshes();
+        int drawn = 0;
+        for (size_t i = 0; i < node.meshIndices.size(); i++) {
+            int meshIndex = node.meshIndices[i];
+            if ((!meshMask || (*meshMask)[meshIndex]) && frustum.intersects(meshBounds[meshIndex])) {
+                if (levelShaders) {
+                    gps::Shader levelShader = (*levelShaders)[(*meshLevels)[meshIndex]];
+                    if (levelShader.shaderProgram != currentProgram) {
+                        levelShader.useShaderProgram();
+                        currentProgram = levelShader.shaderProgram;
+                    }
+                    meshes[meshIndex].Draw(levelShader);
+                }
+                else {
+                    meshes[meshIndex].Draw(shader);
+                }
+                drawn++;
+            }
+        }
+        stats.meshesDrawn += drawn;
+        return drawn;
+    }
+
+    int OcclusionCuller::DrawSubtree(gps::Model3D& model, gps::Shader shader, int nodeIndex)
+    {
+        Node& node = nodes[nodeIndex];
+        if (!frustum.intersects(node.bounds))
+            return 0;
+
+        if (node.children[0] == -1)
+            return DrawLeaf(model, shader, node);
+
+        int left = node.children[0];
+        int right = node.children[1];
+        return DrawSubtree(model, shader, left) + DrawSubtree(model, shader, right);
+    }
+
+    void OcclusionCuller::Draw(gps::Model3D& model, gps::Shader shader, gps::Shader boxShader,
+        glm::mat4 view, glm::mat4 projection, glm::vec3 cameraPosition,
+        const std::vector<bool>* meshMask,
+        const std::vector<gps::Shader>* levelShaders, const std::vector<int>* meshLevels)
+    {
+        this->meshMask = meshMask;
+        this->levelShaders = meshLevels ? levelShaders : nullptr;
+        this->meshLevels = meshLevels;
+
+        stats.queriesIssued = 0;
+        stats.resultsRead = 0;
+        stats.conditionalDraws = 0;
+        stats.savedDraws = 0;
+        stats.meshesDrawn = 0;
+
+        if (nodes.empty()) {
+            if (meshMask) {
+                model.Draw(shader, *meshMask);
+                stats.meshesDrawn = (int)std::count(meshMask->begin(), meshMask->end(), true);
+            }
+            else {
+                model.Draw(shader);
+                stats.meshesDrawn = (int)model.getMeshes().size();
+            }
+            return;
+        }
+
+        ReadQueryResults();
+        frame++;
+        shader.useShaderProgram();
+        currentProgram = shader.shaderProgram;
+
+        frustum.extract(projection * view);
+        hiddenNodes.clear();
+
+        // front to back traversal, the closest node is always expanded first
+        typedef std::pair<float, int> QueueEntry;
+        std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > traversalQueue;
+        traversalQueue.push(QueueEntry(0.0f, 0));
+
+        while (!traversalQueue.empty()) {
+            int nodeIndex = traversalQueue.top().second;
+            traversalQueue.pop();
+            Node& node = nodes[nodeIndex];
+
+            if (!frustum.intersects(node.bounds))
+                continue;
+
+            bool inside = CameraInside(node.bounds, cameraPosition);
+            if (!node.visible && !inside) {
+                hiddenNodes.push_back(nodeIndex);
+                continue;
+            }
+
+            if (node.children[0] == -1) {
+                // visible leaves are re-queried every few frames, spread over the hierarchy
+                bool issueQuery = !inside && node.queryKind == QUERY_NONE &&
+                    (frame + nodeIndex) % visibleQueryInterval == 0;
+                if (issueQuery) {
+                    glBeginQuery(GL_ANY_SAMPLES_PASSED, node.query);
+                }
+                DrawLeaf(model, shader, node);
+                if (issueQuery) {
+                    glEndQuery(GL_ANY_SAMPLES_PASSED);
+                    node.queryKind = QUERY_VISIBLE_NODE;
+                    node.queryFrame = frame;
+                    node.queryTime = std::chrono::steady_clock::now();
+                    stats.queriesIssued++;
+                }
+                continue;
+            }
+
+            for (int c = 0; c < 2; c++) {
+                BoundingBox childBounds = nodes[node.children[c]].bounds;
+                glm::vec3 closest = glm::clamp(cameraPosition, childBounds.min, childBounds.max);
+                traversalQueue.push(QueueEntry(glm::distance(closest, cameraPosition), node.children[c]));
+            }
+        }
+
+        if (hiddenNodes.empty())
+            return;
+
+        // test the hidden nodes in one batch, against the depth of everything drawn above
+        boxShader.useShaderProgram();
+        glUniformMatrix4fv(glGetUniformLocation(boxShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(boxShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        GLint boxModelLoc = glGetUniformLocation(boxShader.shaderProgram, "model");
+
+        // the colour pass may run with GL_EQUAL after a depth pre-pass, boxes need a regular test
+        GLint depthFunc;
+        glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+        GLboolean depthWrites;
+        glGetBooleanv(GL_DEPTH_WRITEMASK, &depthWrites);
+
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LESS);
+        glDisable(GL_CULL_FACE);
+        glBindVertexArray(boxVAO);
+
+        for (size_t i = 0; i < hiddenNodes.size(); i++) {
+            Node& node = nodes[hiddenNodes[i]];
+            // a query still in flight is reused as the render condition
+            if (node.queryKind != QUERY_NONE)
+                continue;
+
+            // slightly enlarged so faces shared with neighbours do not fail the depth test
+            glm::vec3 extent = node.bounds.max - node.bounds.min;
+            glm::vec3 padding = extent * 0.01f + glm::vec3(0.05f);
+            glm::mat4 boxModel = glm::translate(glm::mat4(1.0f), node.bounds.min - padding);
+            boxModel = glm::scale(boxModel, extent + 2.0f * padding);
+            glUniformMatrix4fv(boxModelLoc, 1, GL_FALSE, glm::value_ptr(boxModel));
+
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, node.query);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            RenderStats::countDraw(GL_TRIANGLES, 36);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+            node.queryKind = QUERY_HIDDEN_NODE;
+            node.queryFrame = frame;
+            node.queryTime = std::chrono::steady_clock::now();
+            stats.queriesIssued++;
+        }
+
+        glBindVertexArray(0);
+        glEnable(GL_CULL_FACE);
+        glDepthFunc(depthFunc);
+        glDepthMask(depthWrites);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        shader.useShaderProgram();
+        currentProgram = shader.shaderProgram;
+
+        // the GPU skips the geometry of nodes whose box was hidden
+        for (size_t i = 0; i < hiddenNodes.size(); i++) {
+            Node& node = nodes[hiddenNodes[i]];
+
+            if (node.queryKind == QUERY_HIDDEN_NODE) {
+                // GL_QUERY_WAIT stalls the GPU on its own queue only, the CPU never reads the result here
+                glBeginConditionalRender(node.query, GL_QUERY_WAIT);
+                node.conditionalMeshCount = DrawSubtree(model, shader, hiddenNodes[i]);
+                glEndConditionalRender();
+                stats.conditionalDraws += node.conditionalMeshCount;
+            }
+            else {
+                DrawSubtree(model, shader, hiddenNodes[i]);
+            }
+        }
+    }
+
+    OcclusionStats OcclusionCuller::getStats()
+    {
+        return stats;
+    }
+
+    void OcclusionCuller::Delete()
+    {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            glDeleteQueries(1, &nodes[i].query);
+        }
+        nodes.clear();
+        if (boxVAO) {
+            glDeleteBuffers(1, &boxVBO);
+            glDeleteVertexArrays(1, &boxVAO);
+            boxVAO = 0;
+        }
+    }
+
+    void OcclusionCuller::InitBox()
+    {
+        GLfloat boxVertices[] = {
+            0.0f, 1.0f, 0.0f,  0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,
+            1.0f, 0.0f, 0.0f,  1.0f, 1.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+
+            0.0f, 0.0f, 1.0f,  0.0f, 0.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+            0.0f, 1.0f, 0.0f,  0.0f, 1.0f, 1.0f,  0.0f, 0.0f, 1.0f,
+
+            1.0f, 0.0f, 0.0f,  1.0f, 0.0f, 1.0f,  1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,  1.0f, 1.0f, 0.0f,  1.0f, 0.0f, 0.0f,
+
+            0.0f, 0.0f, 1.0f,  0.0f, 1.0f, 1.0f,  1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,  1.0f, 0.0f, 1.0f,  0.0f, 0.0f, 1.0f,
+
+            0.0f, 1.0f, 0.0f,  1.0f, 1.0f, 0.0f,  1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,  0.0f, 1.0f, 1.0f,  0.0f, 1.0f, 0.0f,
+
+            0.0f, 0.0f, 0.0f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, 0.0f,
+            1.0f, 0.0f, 0.0f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f
+        };
+
+        glGenVertexArrays(1, &boxVAO);
+        glGenBuffers(1, &boxVBO);
+
+        glBindVertexArray(boxVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(boxVertices), &boxVertices, GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+
+        glBindVertexArray(0);
+    }
+
+}
@@ -0,0 +1,99 @@
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+#include "Model3D.hpp"
+#include "Frustum.hpp"
+
+#include <chrono>
+#include <vector>
+
+namespace gps {
+
+    struct OcclusionStats {
+        int queriesIssued;
+        int resultsRead;
+        int conditionalDraws;
+        int savedDraws;
+        // meshes submitted this frame, conditional ones included
+        int meshesDrawn;
+        float averageLatencyFrames;
+        float averageLatencyMs;
+    };
+
+    // Hardware occlusion culling in the style of CHC++: a bounding volume hierarchy over the
+    // meshes of a model is traversed front to back, nodes visible last frame are drawn right away
+    // and nodes hidden last frame are tested with a batch of bounding box queries. Their geometry
+    // is drawn under glBeginConditionalRender, so the results are never read back synchronously.
+    class OcclusionCuller
+    {
+    public:
+        // builds the hierarchy over the meshes of the model, placed in the world by modelMatrix
+        void Build(gps::Model3D& model, glm::mat4 modelMatrix);
+        // draws the model with the given shader, testing hidden nodes with boxShader
+        // (model, view and projection uniforms, position only)
+        // meshes cleared in meshMask, when given, are skipped
+        // with levelShaders and meshLevels, each mesh is drawn with the shader of its level instead
+        void Draw(gps::Model3D& model, gps::Shader shader, gps::Shader boxShader,
+            glm::mat4 view, glm::mat4 projection, glm::vec3 cameraPosition,
+            const std::vector<bool>* meshMask = nullptr,
+            const std::vector<gps::Shader>* levelShaders = nullptr, const std::vector<int>* meshLevels = nullptr);
+        void Delete();
+
+        OcclusionStats getStats();
+
+    private:
+        enum QUERY_KIND { QUERY_NONE, QUERY_VISIBLE_NODE, QUERY_HIDDEN_NODE };
+
+        struct Node {
+            BoundingBox bounds;
+            int children[2];
+            int parent;
+            // meshes of a leaf, children[0] == -1
+            std::vector<int> meshIndices;
+
+            bool visible;
+            bool tested;
+            GLuint query;
+            QUERY_KIND queryKind;
+            long long queryFrame;
+            std::chrono::steady_clock::time_point queryTime;
+            int conditionalMeshCount;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<BoundingBox> meshBounds;
+        std::vector<int> hiddenNodes;
+        const std::vector<bool>* meshMask = nullptr;
+        const std::vector<gps::Shader>* levelShaders = nullptr;
+        const std::vector<int>* meshLevels = nullptr;
+        // program in use while drawing meshes, switched only when the level changes
+        GLuint currentProgram = 0;
+
+        GLuint boxVAO = 0;
+        GLuint boxVBO = 0;
+        long long frame = 0;
+
+        OcclusionStats stats = {};
+        Frustum frustum;
+
+        // nodes visible for several frames are only re-queried every few frames
+        static const int visibleQueryInterval = 4;
+        static const int maxMeshesPerLeaf = 4;
+
+        int BuildNode(std::vector<int>& meshList, int first, int count, int parent);
+        void ReadQueryResults();
+        void PullUpVisibility(int nodeIndex);
+        bool CameraInside(BoundingBox box, glm::vec3 cameraPosition);
+        // both return the number of meshes submitted
+        int DrawLeaf(gps::Model3D& model, gps::Shader shader, Node& node);
+        int DrawSubtree(gps::Model3D& model, gps::Shader shader, int nodeIndex);
+        void InitBox();
+    };
+
+}
+
+#endif /* OcclusionCuller_hpp */
@@ -0,0 +1,330 @@
+#include "PerfGate.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace gps {
+
+    namespace {
+
+        // run to run noise of the timings, the counters only move when the rendering changes
+        const double timingTolerance = 0.25;
+        const double counterTolerance = 0.01;
+
+        // reads the subset of JSON the baseline uses: objects, strings and numbers, other values skipped
+        class JsonReader
+        {
+        public:
+            explicit JsonReader(const std::string& text) : text(text) {}
+
+            bool failed = false;
+
+            void skipSpace() {
+                while (position < text.size() && (text[position] == ' ' || text[position] == '\t' ||
+                    text[position] == '\n' || text[position] == '\r'))
+                    position++;
+            }
+
+            bool peek(char c) {
+                skipSpace();
+                return position < text.size() && text[position] == c;
+            }
+
+            void expect(char c) {
+                if (peek(c))
+                    position++;
+                else
+                    failed = true;
+            }
+
+            std::string readString() {
+                std::string value;
+                expect('"');
+                while (!failed && position < text.size() && text[position] != '"') {
+                    if (text[position] == '\\' && position + 1 < text.size())
+                        position++;
+                    value += text[position++];
+                }
+                expect('"');
+                return value;
+            }
+
+            // true and consumed when the next value is null
+            bool readNull() {
+                if (!peek('n') || text.compare(position, 4, "null") != 0)
+                    return false;
+                position += 4;
+                return true;
+            }
+
+            double readNumber() {
+                skipSpace();
+                const char* start = text.c_str() + position;
+                char* end;
+                double value = strtod(start, &end);
+                if (end == start)
+                    failed = true;
+                position += end - start;
+                return value;
+            }
+
+            void skipValue() {
+                skipSpace();
+                if (peek('{') || peek('[')) {
+                    char close = text[position] == '{' ? '}' : ']';
+                    position++;
+                    while (!failed && !peek(close)) {
+                        if (close == '}') {
+                            readString();
+                            expect(':');
+                        }
+                        skipValue();
+                        if (!peek(close))
+                            expect(',');
+                    }
+                    expect(close);
+                }
+                else if (peek('"')) {
+                    readString();
+                }
+                else {
+                    // numbers, true, false and null
+                    while (position < text.size() && std::string(",}] \t\r\n").find(text[position]) == std::string::npos)
+                        position++;
+                }
+            }
+
+            // calls member for each key of an object, which reads the value
+            template <typename Member>
+            void readObject(Member member) {
+                expect('{');
+                while (!failed && !peek('}')) {
+                    std::string key = readString();
+                    expect(':');
+                    member(key);
+                    if (!peek('}'))
+                        expect(',');
+                }
+                expect('}');
+            }
+
+        private:
+            const std::string& text;
+            size_t position = 0;
+        };
+
+        PerfMetric makeMetric(const char* name, double value, double tolerance)
+        {
+            PerfMetric metric;
+            metric.name = name;
+            metric.value = value;
+            metric.tolerance = tolerance;
+            return metric;
+        }
+
+        const char* getResultName(PERF_RESULT result)
+        {
+            switch (result) {
+            case PERF_PASS:
+                return "ok";
+            case PERF_IMPROVED:
+                return "improved";
+            case PERF_REGRESSED:
+                return "REGRESSED";
+            case PERF_UNSET:
+                return "not recorded";
+            default:
+                return "MISSING";
+            }
+        }
+
+    }
+
+    std::vector<PerfMetric> PerfGate::CollectMetrics(BenchmarkRecorder& recorder)
+    {
+        FrameTimeSummary frameTimes = recorder.getSummary(TIMING_FRAME);
+        FrameTimeSummary cpuTimes = recorder.getSummary(TIMING_CPU);
+        FrameTimeSummary gpuTimes = recorder.getSummary(TIMING_GPU);
+
+        const std::vector<BenchmarkFrame>& frames = recorder.getFrames();
+        RenderCounters totals = {};
+        int maxDrawCalls = 0;
+        for (const BenchmarkFrame& frame : frames) {
+            totals.drawCalls += frame.counters.drawCalls;
+            totals.triangles += frame.counters.triangles;
+            totals.vertices += frame.counters.vertices;
+            totals.programSwitches += frame.counters.programSwitches;
+            totals.textureBinds += frame.counters.textureBinds;
+            totals.uniformUploads += frame.counters.uniformUploads;
+            totals.bufferUploads += frame.counters.bufferUploads;
+            totals.bufferBytes += frame.counters.bufferBytes;
+            maxDrawCalls = std::max(maxDrawCalls, frame.counters.drawCalls);
+        }
+        double frameCount = std::max((double)frames.size(), 1.0);
+
+        std::vector<PerfMetric> metrics;
+        metrics.push_back(makeMetric("frame_p50_ms", frameTimes.p50Ms, timingTolerance));
+        metrics.push_back(makeMetric("frame_p95_ms", frameTimes.p95Ms, timingTolerance));
+        metrics.push_back(makeMetric("frame_p99_ms", frameTimes.p99Ms, timingTolerance));
+        metrics.push_back(makeMetric("cpu_p95_ms", cpuTimes.p95Ms, timingTolerance));
+        metrics.push_back(makeMetric("gpu_p95_ms", gpuTimes.p95Ms, timingTolerance));
+        metrics.push_back(makeMetric("draw_calls_avg", totals.drawCalls / frameCount, counterTolerance));
+        metrics.push_back(makeMetric("draw_calls_max", maxDrawCalls, counterTolerance));
+        metrics.push_back(makeMetric("triangles_avg", totals.triangles / frameCount, counterTolerance));
+        metrics.push_back(makeMetric("vertices_avg", totals.vertices / frameCount, counterTolerance));
+        metrics.push_back(makeMetric("program_switches_avg", totals.programSwitches / frameCount, counterTolerance));
+        metrics.push_back(makeMetric("texture_binds_avg", totals.textureBinds / frameCount, counterTolerance));
+        metrics.push_back(makeMetric("uniform_uploads_avg", totals.uniformUploads / frameCount, counterTolerance));
+        metrics.push_back(makeMetric("buffer_uploads_avg", totals.bufferUploads / frameCount, counterTolerance));
+        metrics.push_back(makeMetric("buffer_bytes_avg", totals.bufferBytes / frameCount, counterTolerance));
+        return metrics;
+    }
+
+    bool PerfGate::LoadBaseline(std::string fileName)
+    {
+        std::ifstream file(fileName.c_str());
+        if (!file) {
+            std::cerr << "ERROR: could not read " << fileName << std::endl;
+            return false;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        std::string text = contents.str();
+
+        baseline.clear();
+        JsonReader reader(text);
+        reader.readObject([&](const std::string& key) {
+            if (key != "metrics") {
+                reader.skipValue();
+                return;
+            }
+            reader.readObject([&](const std::string& name) {
+                PerfMetric metric = makeMetric(name.c_str(), 0.0, 0.0);
+                reader.readObject([&](const std::string& field) {
+                    if (field == "value")
+                        metric.value = reader.readNull() ? NAN : reader.readNumber();
+                    else if (field == "tolerance")
+                        metric.tolerance = reader.readNumber();
+                    else
+                        reader.skipValue();
+                });
+                baseline.push_back(metric);
+            });
+        });
+
+        if (reader.failed || baseline.empty()) {
+            std::cerr << "ERROR: " << fileName << " holds no baseline metrics" << std::endl;
+            baseline.clear();
+            return false;
+        }
+        return true;
+    }
+
+    bool PerfGate::SaveBaseline(std::string fileName, const std::vector<PerfMetric>& metrics)
+    {
+        FILE* file = fopen(fileName.c_str(), "w");
+        if (!file) {
+            std::cerr << "ERROR: could not write " << fileName << std::endl;
+            return false;
+        }
+
+        fprintf(file, "{\n  \"metrics\": {\n");
+        for (size_t i = 0; i < metrics.size(); i++) {
+            char value[32];
+            if (std::isnan(metrics[i].value))
+                snprintf(value, sizeof(value), "null");
+            else
+                snprintf(value, sizeof(value), "%.4f", metrics[i].value);
+            fprintf(file, "    \"%s\": { \"value\": %s, \"tolerance\": %.2f }%s\n", metrics[i].name.c_str(),
+                value, metrics[i].tolerance, i + 1 < metrics.size() ? "," : "");
+        }
+        fprintf(file, "  }\n}\n");
+        bool written = !ferror(file);
+        fclose(file);
+        return written;
+    }
+
+    bool PerfGate::Compare(const std::vector<PerfMetric>& metrics, std::vector<PerfComparison>& comparisons)
+    {
+        comparisons.clear();
+        bool passed = true;
+        for (const PerfMetric& expected : baseline) {
+            PerfComparison comparison;
+            comparison.name = expected.name;
+            comparison.baseline = expected.value;
+            comparison.current = 0.0;
+            comparison.tolerance = expected.tolerance;
+            comparison.result = PERF_MISSING;
+            for (const PerfMetric& metric : metrics) {
+                if (metric.name == expected.name) {
+                    comparison.current = metric.value;
+                    if (std::isnan(expected.value))
+                        comparison.result = PERF_UNSET;
+                    // a zero baseline fails on any increase
+                    else if (metric.value > expected.value * (1.0 + expected.tolerance) + 1e-9)
+                        comparison.result = PERF_REGRESSED;
+                    else if (metric.value < expected.value * (1.0 - expected.tolerance) - 1e-9)
+                        comparison.result = PERF_IMPROVED;
+                    else
+                        comparison.result = PERF_PASS;
+                    break;
+                }
+            }
+            if (comparison.result != PERF_PASS && comparison.result != PERF_IMPROVED)
+                passed = false;
+            comparisons.push_back(comparison);
+        }
+        return passed;
+    }
+
+    void PerfGate::PrintReport(const std::vector<PerfComparison>& comparisons, std::ostream& out)
+    {
+        char line[160];
+        snprintf(line, sizeof(line), "  %-22s%14s%14s%10s%11s", "metric", "baseline", "current", "change", "tolerance");
+        out << line << std::endl;
+
+        int regressed = 0;
+        int improved = 0;
+        int unset = 0;
+        for (const PerfComparison& comparison : comparisons) {
+            char change[32];
+            if (comparison.result == PERF_MISSING || comparison.result == PERF_UNSET)
+                snprintf(change, sizeof(change), "-");
+            else if (comparison.baseline != 0.0)
+                snprintf(change, sizeof(change), "%+.1f%%", 100.0 * (comparison.current - comparison.baseline) / comparison.baseline);
+            else
+                snprintf(change, sizeof(change), "%+.4g", comparison.current);
+            char baseline[32];
+            if (comparison.result == PERF_UNSET)
+                snprintf(baseline, sizeof(baseline), "-");
+            else
+                snprintf(baseline, sizeof(baseline), "%.4f", comparison.baseline);
+            snprintf(line, sizeof(line), "  %-22s%14s%14.4f%10s%10.0f%%  %s", comparison.name.c_str(),
+                baseline, comparison.current, change, 100.0 * comparison.tolerance, getResultName(comparison.result));
+            out << line << std::endl;
+
+            if (comparison.result == PERF_REGRESSED || comparison.result == PERF_MISSING)
+                regressed++;
+            else if (comparison.result == PERF_IMPROVED)
+                improved++;
+            else if (comparison.result == PERF_UNSET)
+                unset++;
+        }
+
+        if (regressed > 0)
+            out << "Perf gate FAILED: " << regressed << " of " << comparisons.size() << " metrics regressed or missing" << std::endl;
+        if (unset > 0)
+            out << "Perf gate FAILED: " << unset << " of " << comparisons.size()
+                << " metrics have no baseline value, record them with --write-baseline" << std::endl;
+        if (regressed == 0 && unset == 0)
+            out << "Perf gate passed: " << comparisons.size() << " metrics within tolerance" << std::endl;
+        if (improved > 0)
+            out << "  " << improved << " metrics improved past their tolerance, the baseline can be tightened" << std::endl;
+    }
+
+}
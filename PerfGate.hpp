@@ -0,0 +1,57 @@
+#ifndef PerfGate_hpp
+#define PerfGate_hpp
+
+#include "BenchmarkRecorder.hpp"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // a measure of a benchmark run where lower is better, with the relative increase over the
+    // baseline value that still passes
+    struct PerfMetric {
+        std::string name;
+        double value;
+        double tolerance;
+    };
+
+    // PERF_UNSET: the baseline lists the metric with a null value, it has not been recorded yet
+    enum PERF_RESULT { PERF_PASS, PERF_IMPROVED, PERF_REGRESSED, PERF_MISSING, PERF_UNSET };
+
+    struct PerfComparison {
+        std::string name;
+        double baseline;
+        double current;
+        double tolerance;
+        PERF_RESULT result;
+    };
+
+    // Performance regression check of a benchmark run against a stored baseline. Frame time
+    // percentiles vary between runs and get a wide tolerance; the per-frame counters are
+    // deterministic on a fixed path, even on software GL, and catch extra draw calls or state
+    // changes that timing alone misses. The baseline is a JSON file,
+    // { "metrics": { "<name>": { "value": <number or null>, "tolerance": <fraction> }, ... } }
+    // a null value is a metric still to be recorded, the gate fails until it has one
+    class PerfGate
+    {
+    public:
+        // frame time percentiles and per-frame averages of the counters, with default tolerances
+        static std::vector<PerfMetric> CollectMetrics(BenchmarkRecorder& recorder);
+
+        bool LoadBaseline(std::string fileName);
+        static bool SaveBaseline(std::string fileName, const std::vector<PerfMetric>& metrics);
+
+        // every baseline metric against the run, false when any regressed, is missing from it or
+        // has no baseline value
+        bool Compare(const std::vector<PerfMetric>& metrics, std::vector<PerfComparison>& comparisons);
+        static void PrintReport(const std::vector<PerfComparison>& comparisons, std::ostream& out);
+
+    private:
+        std::vector<PerfMetric> baseline;
+    };
+
+}
+
+#endif /* PerfGate_hpp */
@@ -0,0 +1,404 @@
+#include "PotentiallyVisibleSet.hpp"
+#include "CpuProfiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <thread>
+
+namespace gps {
+
+    namespace {
+
+        const char pvsMagic[4] = { 'P', 'V', 'S', '1' };
+        // far more than any bake of the city, bounds the counts read from a file
+        const int maxCellsPerAxis = 4096;
+
+        struct Triangle {
+            glm::vec3 v0;
+            glm::vec3 edge1;
+            glm::vec3 edge2;
+            int mesh;
+        };
+
+        struct BvhNode {
+            BoundingBox bounds;
+            // inner nodes: index of the right child, the left one follows the node
+            // leaves: first triangle, with count > 0
+            int first;
+            int count;
+        };
+
+        // bounding volume hierarchy over the triangles of the whole model, used for ray casting
+        class TriangleBvh
+        {
+        public:
+            std::vector<Triangle> triangles;
+            std::vector<BvhNode> nodes;
+
+            void Build() {
+                nodes.clear();
+                nodes.reserve(2 * triangles.size() / leafSize + 1);
+                BuildNode(0, (int)triangles.size());
+            }
+
+            // closest mesh hit by the ray, -1 if it escapes the model
+            int Intersect(glm::vec3 origin, glm::vec3 direction) const {
+                glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+                float closest = 1e30f;
+                int hitMesh = -1;
+
+                int stack[64];
+                int stackSize = 0;
+                stack[stackSize++] = 0;
+
+                while (stackSize > 0) {
+                    int nodeIndex = stack[--stackSize];
+                    const BvhNode& node = nodes[nodeIndex];
+                    if (!IntersectBox(node.bounds, origin, inverseDirection, closest))
+                        continue;
+
+                    if (node.count > 0) {
+                        for (int i = node.first; i < node.first + node.count; i++) {
+                            float t;
+                            if (IntersectTriangle(triangles[i], origin, direction, t) && t < closest) {
+                                closest = t;
+                                hitMesh = triangles[i].mesh;
+                            }
+                        }
+                    }
+                    else if (stackSize < 62) {
+                        stack[stackSize++] = node.first;
+                        stack[stackSize++] = nodeIndex + 1;
+                    }
+                }
+
+                return hitMesh;
+            }
+
+        private:
+            static const int leafSize = 4;
+
+            static glm::vec3 Centroid(const Triangle& triangle) {
+                return triangle.v0 + (triangle.edge1 + triangle.edge2) / 3.0f;
+            }
+
+            int BuildNode(int first, int count) {
+                BvhNode node;
+                node.bounds.min = triangles[first].v0;
+                node.bounds.max = triangles[first].v0;
+                for (int i = first; i < first + count; i++) {
+                    const Triangle& triangle = triangles[i];
+                    glm::vec3 v1 = triangle.v0 + triangle.edge1;
+                    glm::vec3 v2 = triangle.v0 + triangle.edge2;
+                    node.bounds.min = glm::min(node.bounds.min, glm::min(triangle.v0, glm::min(v1, v2)));
+                    node.bounds.max = glm::max(node.bounds.max, glm::max(triangle.v0, glm::max(v1, v2)));
+                }
+
+                int nodeIndex = (int)nodes.size();
+                nodes.push_back(node);
+
+                if (count <= leafSize) {
+                    nodes[nodeIndex].first = first;
+                    nodes[nodeIndex].count = count;
+                    return nodeIndex;
+                }
+
+                glm::vec3 extent = node.bounds.max - node.bounds.min;
+                int axis = 0;
+                if (extent.y > extent[axis])
+                    axis = 1;
+                if (extent.z > extent[axis])
+                    axis = 2;
+
+                int half = count / 2;
+                std::nth_element(triangles.begin() + first, triangles.begin() + first + half, triangles.begin() + first + count,
+                    [axis](const Triangle& a, const Triangle& b) {
+                        return Centroid(a)[axis] < Centroid(b)[axis];
+                    });
+
+                // the left child directly follows its parent, the right one is stored in first
+                BuildNode(first, half);
+                int right = BuildNode(first + half, count - half);
+                nodes[nodeIndex].first = right;
+                nodes[nodeIndex].count = 0;
+
+                return nodeIndex;
+            }
+
+            static bool IntersectBox(const BoundingBox& box, glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance) {
+                float tMin = 0.0f;
+                float tMax = maxDistance;
+                for (int axis = 0; axis < 3; axis++) {
+                    float t0 = (box.min[axis] - origin[axis]) * inverseDirection[axis];
+                    float t1 = (box.max[axis] - origin[axis]) * inverseDirection[axis];
+                    if (t0 > t1)
+                        std::swap(t0, t1);
+                    tMin = std::max(tMin, t0);
+                    tMax = std::min(tMax, t1);
+                    if (tMin > tMax)
+                        return false;
+                }
+                return true;
+            }
+
+            // Moller-Trumbore, both faces count since walls hide what is behind them either way
+            static bool IntersectTriangle(const Triangle& triangle, glm::vec3 origin, glm::vec3 direction, float& t) {
+                glm::vec3 p = glm::cross(direction, triangle.edge2);
+                float determinant = glm::dot(triangle.edge1, p);
+                if (std::abs(determinant) < 1e-8f)
+                    return false;
+
+                float inverseDeterminant = 1.0f / determinant;
+                glm::vec3 s = origin - triangle.v0;
+                float u = glm::dot(s, p) * inverseDeterminant;
+                if (u < 0.0f || u > 1.0f)
+                    return false;
+
+                glm::vec3 q = glm::cross(s, triangle.edge1);
+                float v = glm::dot(direction, q) * inverseDeterminant;
+                if (v < 0.0f || u + v > 1.0f)
+                    return false;
+
+                t = glm::dot(triangle.edge2, q) * inverseDeterminant;
+                return t > 1e-4f;
+            }
+        };
+
+    }
+
+    void PotentiallyVisibleSet::Bake(gps::Model3D& model, glm::mat4 modelMatrix, BoundingBox volume, float cellSize,
+        int samplesPerCell, int raysPerSample)
+    {
+        std::vector<gps::Mesh>& meshes = model.getMeshes();
+
+        TriangleBvh bvh;
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const gps::Mesh& mesh = meshes[m];
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                glm::vec3 v0 = glm::vec3(modelMatrix * glm::vec4(mesh.vertices[mesh.indices[i]].Position, 1.0f));
+                glm::vec3 v1 = glm::vec3(modelMatrix * glm::vec4(mesh.vertices[mesh.indices[i + 1]].Position, 1.0f));
+                glm::vec3 v2 = glm::vec3(modelMatrix * glm::vec4(mesh.vertices[mesh.indices[i + 2]].Position, 1.0f));
+                Triangle triangle;
+                triangle.v0 = v0;
+                triangle.edge1 = v1 - v0;
+                triangle.edge2 = v2 - v0;
+                triangle.mesh = (int)m;
+                bvh.triangles.push_back(triangle);
+            }
+        }
+
+        this->origin = volume.min;
+        this->cellSize = cellSize;
+        for (int axis = 0; axis < 3; axis++) {
+            cellCount[axis] = std::max(1, (int)std::ceil((volume.max[axis] - volume.min[axis]) / cellSize));
+        }
+        meshCount = (int)meshes.size();
+        wordsPerCell = (meshCount + 63) / 64;
+
+        int totalCells = cellCount[0] * cellCount[1] * cellCount[2];
+        bits.assign((size_t)totalCells * wordsPerCell, 0);
+
+        if (bvh.triangles.empty()) {
+            return;
+        }
+
+        std::cout << "Baking PVS: " << bvh.triangles.size() << " triangles, "
+            << cellCount[0] << "x" << cellCount[1] << "x" << cellCount[2] << " cells" << std::endl;
+        bvh.Build();
+
+        // evenly spread directions on the sphere, rotated randomly for every sample point
+        std::vector<glm::vec3> directions;
+        const float goldenAngle = 2.39996323f;
+        for (int i = 0; i < raysPerSample; i++) {
+            float y = 1.0f - 2.0f * (i + 0.5f) / raysPerSample;
+            float radius = std::sqrt(std::max(0.0f, 1.0f - y * y));
+            directions.push_back(glm::vec3(std::cos(goldenAngle * i) * radius, y, std::sin(goldenAngle * i) * radius));
+        }
+
+        std::vector<uint64_t> sampledBits(bits.size(), 0);
+        std::atomic<int> nextCell(0);
+
+        auto bakeCells = [&]() {
+            gps::CpuProfiler::setThreadName("PVS bake");
+            for (int cell = nextCell++; cell < totalCells; cell = nextCell++) {
+                PROFILE_ZONE("bake cell");
+                int x = cell % cellCount[0];
+                int y = (cell / cellCount[0]) % cellCount[1];
+                int z = cell / (cellCount[0] * cellCount[1]);
+                glm::vec3 cellMin = origin + glm::vec3((float)x, (float)y, (float)z) * cellSize;
+
+                // seeded by cell so bakes are reproducible
+                std::mt19937 random((unsigned int)cell);
+                std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+                uint64_t* cellBits = &sampledBits[(size_t)cell * wordsPerCell];
+
+                for (int s = 0; s < samplesPerCell; s++) {
+                    glm::vec3 samplePoint = cellMin + glm::vec3(unit(random), unit(random), unit(random)) * cellSize;
+                    float angle = unit(random) * 6.2831853f;
+                    float cosAngle = std::cos(angle);
+                    float sinAngle = std::sin(angle);
+
+                    for (size_t r = 0; r < directions.size(); r++) {
+                        glm::vec3 d = directions[r];
+                        glm::vec3 direction(d.x * cosAngle - d.z * sinAngle, d.y, d.x * sinAngle + d.z * cosAngle);
+                        int mesh = bvh.Intersect(samplePoint, direction);
+                        if (mesh >= 0) {
+                            cellBits[mesh >> 6] |= (uint64_t)1 << (mesh & 63);
+                        }
+                    }
+                }
+            }
+        };
+
+        unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < threadCount; i++) {
+            workers.push_back(std::thread(bakeCells));
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+
+        // sampling is not exhaustive, widen every cell with its neighbours to avoid popping
+        for (int cell = 0; cell < totalCells; cell++) {
+            int x = cell % cellCount[0];
+            int y = (cell / cellCount[0]) % cellCount[1];
+            int z = cell / (cellCount[0] * cellCount[1]);
+            uint64_t* cellBits = &bits[(size_t)cell * wordsPerCell];
+
+            for (int dz = -1; dz <= 1; dz++)
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int nx = x + dx, ny = y + dy, nz = z + dz;
+                        if (nx < 0 || ny < 0 || nz < 0 || nx >= cellCount[0] || ny >= cellCount[1] || nz >= cellCount[2])
+                            continue;
+                        int neighbour = nx + cellCount[0] * (ny + cellCount[1] * nz);
+                        const uint64_t* neighbourBits = &sampledBits[(size_t)neighbour * wordsPerCell];
+                        for (int w = 0; w < wordsPerCell; w++) {
+                            cellBits[w] |= neighbourBits[w];
+                        }
+                    }
+        }
+
+        long long visibleTotal = 0;
+        for (int cell = 0; cell < totalCells; cell++) {
+            visibleTotal += countVisibleMeshes(cell);
+        }
+        std::cout << "PVS baked with " << threadCount << " threads, on average "
+            << (float)visibleTotal / totalCells << " of " << meshCount << " meshes visible per cell" << std::endl;
+    }
+
+    bool PotentiallyVisibleSet::Save(std::string fileName)
+    {
+        std::ofstream file(fileName.c_str(), std::ios::binary);
+        if (!file) {
+            std::cerr << "ERROR: could not write " << fileName << std::endl;
+            return false;
+        }
+
+        file.write(pvsMagic, sizeof(pvsMagic));
+        file.write((const char*)&origin, sizeof(float) * 3);
+        file.write((const char*)&cellSize, sizeof(cellSize));
+        file.write((const char*)cellCount, sizeof(cellCount));
+        file.write((const char*)&meshCount, sizeof(meshCount));
+        file.write((const char*)bits.data(), bits.size() * sizeof(uint64_t));
+        return (bool)file;
+    }
+
+    bool PotentiallyVisibleSet::Load(std::string fileName, int expectedMeshCount)
+    {
+        std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+        if (!file) {
+            return false;
+        }
+        std::streamoff fileSize = file.tellg();
+        file.seekg(0);
+
+        char magic[4];
+        file.read(magic, sizeof(magic));
+        file.read((char*)&origin, sizeof(float) * 3);
+        file.read((char*)&cellSize, sizeof(cellSize));
+        file.read((char*)cellCount, sizeof(cellCount));
+        file.read((char*)&meshCount, sizeof(meshCount));
+
+        // the cell bits have to fill the rest of the file exactly, a stale or cut off bake is rejected
+        // before anything is allocated from its counts
+        bool valid = file && std::equal(magic, magic + 4, pvsMagic) && meshCount == expectedMeshCount &&
+            meshCount > 0 && cellSize > 0.0f && std::isfinite(cellSize);
+        size_t totalCells = 1;
+        for (int axis = 0; axis < 3 && valid; axis++) {
+            valid = cellCount[axis] > 0 && cellCount[axis] <= maxCellsPerAxis;
+            totalCells *= valid ? (size_t)cellCount[axis] : 0;
+        }
+        wordsPerCell = (meshCount + 63) / 64;
+        if (valid) {
+            std::streamoff bitsSize = (std::streamoff)(totalCells * wordsPerCell * sizeof(uint64_t));
+            valid = fileSize - file.tellg() == bitsSize;
+        }
+
+        if (!valid) {
+            std::cerr << "WARNING: " << fileName << " does not match the loaded model, rebake it with --bake-pvs" << std::endl;
+            meshCount = 0;
+            cellCount[0] = cellCount[1] = cellCount[2] = 0;
+            bits.clear();
+            return false;
+        }
+
+        bits.resize(totalCells * wordsPerCell);
+        file.read((char*)bits.data(), bits.size() * sizeof(uint64_t));
+        if (!file) {
+            bits.clear();
+            return false;
+        }
+
+        std::cout << "Loaded PVS " << fileName << " with " << totalCells << " cells" << std::endl;
+        return true;
+    }
+
+    bool PotentiallyVisibleSet::isLoaded()
+    {
+        return !bits.empty();
+    }
+
+    int PotentiallyVisibleSet::findCell(glm::vec3 position)
+    {
+        if (bits.empty())
+            return -1;
+
+        glm::vec3 local = (position - origin) / cellSize;
+        int x = (int)std::floor(local.x);
+        int y = (int)std::floor(local.y);
+        int z = (int)std::floor(local.z);
+        if (x < 0 || y < 0 || z < 0 || x >= cellCount[0] || y >= cellCount[1] || z >= cellCount[2])
+            return -1;
+
+        return x + cellCount[0] * (y + cellCount[1] * z);
+    }
+
+    void PotentiallyVisibleSet::getVisibleMeshes(int cell, std::vector<bool>& meshMask)
+    {
+        meshMask.assign(meshCount, true);
+        if (cell < 0)
+            return;
+
+        const uint64_t* cellBits = &bits[(size_t)cell * wordsPerCell];
+        for (int mesh = 0; mesh < meshCount; mesh++) {
+            meshMask[mesh] = ((cellBits[mesh >> 6] >> (mesh & 63)) & 1) != 0;
+        }
+    }
+
+    int PotentiallyVisibleSet::countVisibleMeshes(int cell)
+    {
+        int count = 0;
+        const uint64_t* cellBits = &bits[(size_t)cell * wordsPerCell];
+        for (int mesh = 0; mesh < meshCount; mesh++) {
+            if ((cellBits[mesh >> 6] >> (mesh & 63)) & 1)
+                count++;
+        }
+        return count;
+    }
+
+}
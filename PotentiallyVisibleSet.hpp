@@ -0,0 +1,44 @@
+#ifndef PotentiallyVisibleSet_hpp
+#define PotentiallyVisibleSet_hpp
+
+#include <glm/glm.hpp>
+
+#include "Model3D.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Precomputed visibility for a model: the walkable volume is split into a grid of cells and
+    // each cell stores one bit per mesh, set if the mesh can be seen from anywhere in the cell.
+    class PotentiallyVisibleSet
+    {
+    public:
+        // samples every cell of the volume with rays cast from random points, on all hardware threads
+        void Bake(gps::Model3D& model, glm::mat4 modelMatrix, BoundingBox volume, float cellSize,
+            int samplesPerCell, int raysPerSample);
+
+        bool Save(std::string fileName);
+        bool Load(std::string fileName, int meshCount);
+
+        bool isLoaded();
+        // index of the cell holding the position, -1 outside the volume
+        int findCell(glm::vec3 position);
+        // fills one flag per mesh for the given cell
+        void getVisibleMeshes(int cell, std::vector<bool>& meshMask);
+        int countVisibleMeshes(int cell);
+
+    private:
+        glm::vec3 origin;
+        float cellSize = 0.0f;
+        int cellCount[3] = { 0, 0, 0 };
+        int meshCount = 0;
+        int wordsPerCell = 0;
+        std::vector<uint64_t> bits;
+    };
+
+}
+
+#endif /* PotentiallyVisibleSet_hpp */
@@ -0,0 +1,209 @@
+#include "RenderStats.hpp"
+
+namespace gps {
+
+    namespace {
+
+        std::vector<PassStats> framePasses;
+        std::vector<PassStats> lastFramePasses;
+        // indices into framePasses, the innermost last
+        std::vector<int> passStack;
+        int currentPass = -1;
+        GLuint currentProgram = 0;
+
+        int findPass(const char* name)
+        {
+            for (size_t i = 0; i < framePasses.size(); i++) {
+                if (framePasses[i].name == name)
+                    return (int)i;
+            }
+            PassStats pass = {};
+            pass.name = name;
+            framePasses.push_back(pass);
+            return (int)framePasses.size() - 1;
+        }
+
+        RenderCounters& counters()
+        {
+            if (currentPass < 0)
+                currentPass = findPass("other");
+            return framePasses[currentPass].counters;
+        }
+
+        PFNGLUSEPROGRAMPROC originalUseProgram;
+        PFNGLUNIFORM1IPROC originalUniform1i;
+        PFNGLUNIFORM1FPROC originalUniform1f;
+        PFNGLUNIFORM1FVPROC originalUniform1fv;
+        PFNGLUNIFORM2FPROC originalUniform2f;
+        PFNGLUNIFORM3FVPROC originalUniform3fv;
+        PFNGLUNIFORM3IPROC originalUniform3i;
+        PFNGLUNIFORMMATRIX3FVPROC originalUniformMatrix3fv;
+        PFNGLUNIFORMMATRIX4FVPROC originalUniformMatrix4fv;
+        PFNGLBUFFERDATAPROC originalBufferData;
+        PFNGLBUFFERSUBDATAPROC originalBufferSubData;
+
+        void GLAPIENTRY countUseProgram(GLuint program)
+        {
+            if (program != currentProgram) {
+                counters().programSwitches++;
+                currentProgram = program;
+            }
+            originalUseProgram(program);
+        }
+
+        void GLAPIENTRY countUniform1i(GLint location, GLint v0)
+        {
+            counters().uniformUploads++;
+            originalUniform1i(location, v0);
+        }
+
+        void GLAPIENTRY countUniform1f(GLint location, GLfloat v0)
+        {
+            counters().uniformUploads++;
+            originalUniform1f(location, v0);
+        }
+
+        void GLAPIENTRY countUniform1fv(GLint location, GLsizei count, const GLfloat* value)
+        {
+            counters().uniformUploads++;
+            originalUniform1fv(location, count, value);
+        }
+
+        void GLAPIENTRY countUniform2f(GLint location, GLfloat v0, GLfloat v1)
+        {
+            counters().uniformUploads++;
+            originalUniform2f(location, v0, v1);
+        }
+
+        void GLAPIENTRY countUniform3fv(GLint location, GLsizei count, const GLfloat* value)
+        {
+            counters().uniformUploads++;
+            originalUniform3fv(location, count, value);
+        }
+
+        void GLAPIENTRY countUniform3i(GLint location, GLint v0, GLint v1, GLint v2)
+        {
+            counters().uniformUploads++;
+            originalUniform3i(location, v0, v1, v2);
+        }
+
+        void GLAPIENTRY countUniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+        {
+            counters().uniformUploads++;
+            originalUniformMatrix3fv(location, count, transpose, value);
+        }
+
+        void GLAPIENTRY countUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+        {
+            counters().uniformUploads++;
+            originalUniformMatrix4fv(location, count, transpose, value);
+        }
+
+        void GLAPIENTRY countBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+        {
+            RenderCounters& frameCounters = counters();
+            frameCounters.bufferUploads++;
+            frameCounters.bufferBytes += size;
+            originalBufferData(target, size, data, usage);
+        }
+
+        void GLAPIENTRY countBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+        {
+            RenderCounters& frameCounters = counters();
+            frameCounters.bufferUploads++;
+            frameCounters.bufferBytes += size;
+            originalBufferSubData(target, offset, size, data);
+        }
+
+    }
+
+    void RenderStats::InstallHooks()
+    {
+        // the glUniform* variants the project calls, others go uncounted
+        originalUseProgram = __glewUseProgram;
+        __glewUseProgram = countUseProgram;
+        originalUniform1i = __glewUniform1i;
+        __glewUniform1i = countUniform1i;
+        originalUniform1f = __glewUniform1f;
+        __glewUniform1f = countUniform1f;
+        originalUniform1fv = __glewUniform1fv;
+        __glewUniform1fv = countUniform1fv;
+        originalUniform2f = __glewUniform2f;
+        __glewUniform2f = countUniform2f;
+        originalUniform3fv = __glewUniform3fv;
+        __glewUniform3fv = countUniform3fv;
+        originalUniform3i = __glewUniform3i;
+        __glewUniform3i = countUniform3i;
+        originalUniformMatrix3fv = __glewUniformMatrix3fv;
+        __glewUniformMatrix3fv = countUniformMatrix3fv;
+        originalUniformMatrix4fv = __glewUniformMatrix4fv;
+        __glewUniformMatrix4fv = countUniformMatrix4fv;
+        originalBufferData = __glewBufferData;
+        __glewBufferData = countBufferData;
+        originalBufferSubData = __glewBufferSubData;
+        __glewBufferSubData = countBufferSubData;
+    }
+
+    void RenderStats::BeginFrame()
+    {
+        lastFramePasses.swap(framePasses);
+        framePasses.clear();
+        passStack.clear();
+        currentPass = -1;
+    }
+
+    void RenderStats::BeginPass(const char* name)
+    {
+        currentPass = findPass(name);
+        passStack.push_back(currentPass);
+    }
+
+    void RenderStats::EndPass()
+    {
+        if (!passStack.empty())
+            passStack.pop_back();
+        currentPass = passStack.empty() ? -1 : passStack.back();
+    }
+
+    void RenderStats::countDraw(GLenum mode, GLsizei vertexCount)
+    {
+        RenderCounters& frameCounters = counters();
+        frameCounters.drawCalls++;
+        frameCounters.vertices += vertexCount;
+        if (mode == GL_TRIANGLES)
+            frameCounters.triangles += vertexCount / 3;
+    }
+
+    void RenderStats::countTextureBinds(int count)
+    {
+        counters().textureBinds += count;
+    }
+
+    void RenderStats::countCulled(int count)
+    {
+        counters().culledObjects += count;
+    }
+
+    RenderCounters RenderStats::getLastFrameTotals()
+    {
+        RenderCounters totals = {};
+        for (const PassStats& pass : lastFramePasses) {
+            totals.drawCalls += pass.counters.drawCalls;
+            totals.triangles += pass.counters.triangles;
+            totals.vertices += pass.counters.vertices;
+            totals.programSwitches += pass.counters.programSwitches;
+            totals.textureBinds += pass.counters.textureBinds;
+            totals.uniformUploads += pass.counters.uniformUploads;
+            totals.bufferUploads += pass.counters.bufferUploads;
+            totals.bufferBytes += pass.counters.bufferBytes;
+            totals.culledObjects += pass.counters.culledObjects;
+        }
+        return totals;
+    }
+
+    const std::vector<PassStats>& RenderStats::getLastFramePasses()
+    {
+        return lastFramePasses;
+    }
+
+}
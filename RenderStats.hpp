@@ -0,0 +1,56 @@
+#ifndef RenderStats_hpp
+#define RenderStats_hpp
+
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    struct RenderCounters {
+        int drawCalls;
+        long long triangles;
+        long long vertices;
+        int programSwitches;
+        int textureBinds;
+        int uniformUploads;
+        int bufferUploads;
+        long long bufferBytes;
+        // objects skipped by culling before they were drawn, or skipped by the GPU after an occlusion query
+        int culledObjects;
+    };
+
+    struct PassStats {
+        std::string name;
+        RenderCounters counters;
+    };
+
+    // What is submitted to the GPU each frame, split by the pass in progress. The entry points
+    // GLEW loads through function pointers (programs, uniforms, buffer uploads) are counted by
+    // hooks installed over those pointers, the core 1.1 draws and texture binds where they are
+    // issued. Counting is always on, a counter increment per call.
+    class RenderStats
+    {
+    public:
+        // after glewInit
+        static void InstallHooks();
+
+        // the counts of the frame that ends become the last frame's
+        static void BeginFrame();
+        // counts go to the innermost pass, and to "other" outside any pass
+        static void BeginPass(const char* name);
+        static void EndPass();
+
+        static void countDraw(GLenum mode, GLsizei vertexCount);
+        static void countTextureBinds(int count);
+        static void countCulled(int count);
+
+        static RenderCounters getLastFrameTotals();
+        // in the order the passes first ran in the frame
+        static const std::vector<PassStats>& getLastFramePasses();
+    };
+
+}
+
+#endif /* RenderStats_hpp */
@@ -1,6 +1,75 @@
 #include "Shader.hpp"
+#include "CpuProfiler.hpp"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 namespace gps {
+    std::string Shader::binaryCacheDirectory = "shaders/cache";
+    int Shader::cachedProgramCount = 0;
+    int Shader::compiledProgramCount = 0;
+    bool Shader::compilerThreadsSet = false;
+
+    //header of a cached program binary, the hash guards against renamed or mixed up files
+    struct ProgramBinaryHeader {
+        uint32_t magic;
+        uint32_t format;
+        uint64_t hash;
+    };
+
+    static const uint32_t programBinaryMagic = 0x4E494250; // "PBIN"
+
+    //64 bit FNV-1a
+    static uint64_t hashString(uint64_t hash, const std::string& text)
+    {
+        for (unsigned char c : text) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        //separator, so "ab" + "c" and "a" + "bc" differ
+        hash ^= 0xFF;
+        hash *= 1099511628211ull;
+        return hash;
+    }
+
+    static std::string getGLString(GLenum name)
+    {
+        const GLubyte* value = glGetString(name);
+        return value ? std::string((const char*)value) : std::string();
+    }
+
+    static uint64_t hashProgram(const std::string& vertexSource, const std::string& fragmentSource)
+    {
+        //a binary is only valid for the driver that produced it
+        uint64_t hash = 14695981039346656037ull;
+        hash = hashString(hash, vertexSource);
+        hash = hashString(hash, fragmentSource);
+        hash = hashString(hash, getGLString(GL_VENDOR));
+        hash = hashString(hash, getGLString(GL_RENDERER));
+        hash = hashString(hash, getGLString(GL_VERSION));
+        return hash;
+    }
+
+    void Shader::setBinaryCacheDirectory(std::string directory)
+    {
+        binaryCacheDirectory = directory;
+    }
+
+    int Shader::getCachedProgramCount()
+    {
+        return cachedProgramCount;
+    }
+
+    int Shader::getCompiledProgramCount()
+    {
+        return compiledProgramCount;
+    }
+
     std::string Shader::readShaderFile(std::string fileName)
     {
         std::ifstream shaderFile;
@@ -22,6 +91,95 @@ namespace gps {
         return shaderString;
     }
 
+    std::string Shader::insertDefines(std::string source, const std::vector<std::string>& defines)
+    {
+        if (defines.empty())
+            return source;
+
+        std::string defineLines;
+        for (const std::string& define : defines) {
+            defineLines += "#define " + define + "\n";
+        }
+
+        //the #version directive has to stay first
+        size_t lineEnd = source.find('\n');
+        if (source.compare(0, 8, "#version") != 0 || lineEnd == std::string::npos)
+            return defineLines + source;
+        return source.insert(lineEnd + 1, defineLines);
+    }
+
+    std::string Shader::getBinaryCacheFile(uint64_t hash)
+    {
+        if (binaryCacheDirectory.empty())
+            return std::string();
+
+        //drivers without binary formats cannot cache anything
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        if (formatCount == 0)
+            return std::string();
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hash);
+        return binaryCacheDirectory + "/" + name;
+    }
+
+    bool Shader::loadProgramBinary(std::string fileName, uint64_t hash)
+    {
+        std::ifstream binaryFile(fileName.c_str(), std::ios::binary);
+        if (!binaryFile)
+            return false;
+
+        ProgramBinaryHeader header;
+        if (!binaryFile.read((char*)&header, sizeof(header)) || header.magic != programBinaryMagic || header.hash != hash)
+            return false;
+        std::vector<char> binary((std::istreambuf_iterator<char>(binaryFile)), std::istreambuf_iterator<char>());
+        if (binary.empty())
+            return false;
+
+        this->shaderProgram = glCreateProgram();
+        glProgramBinary(this->shaderProgram, header.format, binary.data(), (GLsizei)binary.size());
+
+        //the driver rejects binaries it can no longer use, the program is then compiled again
+        GLint success;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &success);
+        if (!success) {
+            glDeleteProgram(this->shaderProgram);
+            this->shaderProgram = 0;
+            return false;
+        }
+        return true;
+    }
+
+    void Shader::saveProgramBinary(std::string fileName, uint64_t hash)
+    {
+        GLint length = 0;
+        glGetProgramiv(this->shaderProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        ProgramBinaryHeader header;
+        header.magic = programBinaryMagic;
+        std::vector<char> binary(length);
+        GLenum format;
+        glGetProgramBinary(this->shaderProgram, length, &length, &format, binary.data());
+        header.format = format;
+        header.hash = hash;
+
+#ifdef _WIN32
+        _mkdir(binaryCacheDirectory.c_str());
+#else
+        mkdir(binaryCacheDirectory.c_str(), 0755);
+#endif
+        std::ofstream binaryFile(fileName.c_str(), std::ios::binary);
+        if (!binaryFile) {
+            std::cout << "Cannot write the program binary " << fileName << std::endl;
+            return;
+        }
+        binaryFile.write((const char*)&header, sizeof(header));
+        binaryFile.write(binary.data(), length);
+    }
+
     void Shader::shaderCompileLog(GLuint shaderId)
     {
         GLint success;
@@ -49,37 +207,95 @@ namespace gps {
         }
     }
 
-    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName)
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+        const std::vector<std::string>& defines)
     {
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
+        beginLoading(vertexShaderFileName, fragmentShaderFileName, defines);
+        finishLoading();
+    }
+
+    void Shader::beginLoading(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+        const std::vector<std::string>& defines)
+    {
+        PROFILE_ZONE("Shader::beginLoading");
+        std::string v = insertDefines(readShaderFile(vertexShaderFileName), defines);
+        std::string f = insertDefines(readShaderFile(fragmentShaderFileName), defines);
+
+        binaryHash = hashProgram(v, f);
+        binaryCacheFile = getBinaryCacheFile(binaryHash);
+        if (!binaryCacheFile.empty() && loadProgramBinary(binaryCacheFile, binaryHash)) {
+            cachedProgramCount++;
+            return;
+        }
+
+        //the driver compiles on its own threads, nothing below waits for it
+        if (GLEW_KHR_parallel_shader_compile && !compilerThreadsSet) {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            compilerThreadsSet = true;
+        }
+
+        //compile the vertex shader
         const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
         vertexShader = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
         glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
 
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
+        //compile the fragment shader
         const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
         fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
         glCompileShader(fragmentShader);
-        //check compilation status
-        shaderCompileLog(fragmentShader);
 
         //attach and link the shader programs
         this->shaderProgram = glCreateProgram();
         glAttachShader(this->shaderProgram, vertexShader);
         glAttachShader(this->shaderProgram, fragmentShader);
+        if (!binaryCacheFile.empty()) {
+            glProgramParameteri(this->shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
         glLinkProgram(this->shaderProgram);
+        loading = true;
+    }
+
+    bool Shader::isReady()
+    {
+        if (!loading)
+            return true;
+
+        //without the extension any status query blocks, so the program is finished right away
+        if (GLEW_KHR_parallel_shader_compile) {
+            GLint completed = GL_FALSE;
+            glGetProgramiv(this->shaderProgram, GL_COMPLETION_STATUS_KHR, &completed);
+            if (!completed)
+                return false;
+        }
+        finishLoading();
+        return true;
+    }
+
+    void Shader::finishLoading()
+    {
+        if (!loading)
+            return;
+        PROFILE_ZONE("Shader::finishLoading");
+        loading = false;
+
+        //check compilation status
+        shaderCompileLog(vertexShader);
+        shaderCompileLog(fragmentShader);
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
+        vertexShader = 0;
+        fragmentShader = 0;
         //check linking info
         shaderLinkLog(this->shaderProgram);
+        compiledProgramCount++;
+
+        GLint success;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &success);
+        if (!binaryCacheFile.empty() && success) {
+            saveProgramBinary(binaryCacheFile, binaryHash);
+        }
     }
 
     void Shader::useShaderProgram()
@@ -3,11 +3,13 @@
 
 #include <GL/glew.h>
 
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
 namespace gps {
 
@@ -15,11 +17,48 @@ class Shader
 {
 public:
     GLuint shaderProgram;
-    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+    // every name in defines is #defined in both stages, right after the #version line
+    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+        const std::vector<std::string>& defines = std::vector<std::string>());
     void useShaderProgram();
 
+    // loadShader in two halves: beginLoading submits the compile and link without waiting for them,
+    // with KHR_parallel_shader_compile the driver works on them in the background
+    void beginLoading(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+        const std::vector<std::string>& defines = std::vector<std::string>());
+    // polls the driver without blocking, and finishes the program once it is done
+    // without the extension the program is finished right away
+    bool isReady();
+    // waits for the program, then checks the logs and stores the binary
+    void finishLoading();
+
+    // linked programs are saved as driver binaries in this directory, keyed by their sources,
+    // defines and driver, and loaded instead of compiled on the next run
+    // an empty directory disables the cache
+    static void setBinaryCacheDirectory(std::string directory);
+    // programs loaded from the cache and compiled from source since startup
+    static int getCachedProgramCount();
+    static int getCompiledProgramCount();
+
 private:
+    static std::string binaryCacheDirectory;
+    static int cachedProgramCount;
+    static int compiledProgramCount;
+    static bool compilerThreadsSet;
+
+    // stages and cache entry of a program still compiling
+    bool loading = false;
+    GLuint vertexShader = 0;
+    GLuint fragmentShader = 0;
+    uint64_t binaryHash = 0;
+    std::string binaryCacheFile;
+
     std::string readShaderFile(std::string fileName);
+    std::string insertDefines(std::string source, const std::vector<std::string>& defines);
+    // empty when the cache is disabled or the driver has no binary formats
+    std::string getBinaryCacheFile(uint64_t hash);
+    bool loadProgramBinary(std::string fileName, uint64_t hash);
+    void saveProgramBinary(std::string fileName, uint64_t hash);
     void shaderCompileLog(GLuint shaderId);
     void shaderLinkLog(GLuint shaderProgramId);
 };
@@ -0,0 +1,66 @@
+#include "ShaderLod.hpp"
+
+namespace gps {
+
+    void ShaderLod::Create(const std::vector<float>& distances, float hysteresis)
+    {
+        this->distances = distances;
+        this->hysteresis = hysteresis;
+        tiers.clear();
+        tierCounts.assign(distances.size() + 1, 0);
+    }
+
+    void ShaderLod::Update(const std::vector<BoundingBox>& bounds, glm::vec3 cameraPosition)
+    {
+        // new objects start at the tier of their distance, without hysteresis
+        tiers.resize(bounds.size(), -1);
+
+        tierCounts.assign(distances.size() + 1, 0);
+        for (size_t i = 0; i < bounds.size(); i++) {
+            glm::vec3 closest = glm::clamp(cameraPosition, bounds[i].min, bounds[i].max);
+            float distance = glm::distance(closest, cameraPosition);
+
+            int tier = tiers[i];
+            float margin = hysteresis;
+            if (tier < 0) {
+                tier = 0;
+                margin = 0.0f;
+            }
+            while (tier < (int)distances.size() && distance > distances[tier] + margin)
+                tier++;
+            while (tier > 0 && distance < distances[tier - 1] - margin)
+                tier--;
+            tiers[i] = tier;
+            tierCounts[tier]++;
+        }
+    }
+
+    int ShaderLod::getTierCount()
+    {
+        return (int)distances.size() + 1;
+    }
+
+    int ShaderLod::getTier(int object)
+    {
+        return tiers[object];
+    }
+
+    const std::vector<int>& ShaderLod::getTiers()
+    {
+        return tiers;
+    }
+
+    int ShaderLod::countObjects(int tier)
+    {
+        return tierCounts[tier];
+    }
+
+    void ShaderLod::getTierMask(int tier, std::vector<bool>& mask, const std::vector<bool>* objectMask)
+    {
+        mask.resize(tiers.size());
+        for (size_t i = 0; i < tiers.size(); i++) {
+            mask[i] = tiers[i] == tier && (!objectMask || (*objectMask)[i]);
+        }
+    }
+
+}
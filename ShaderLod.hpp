@@ -0,0 +1,41 @@
+#ifndef ShaderLod_hpp
+#define ShaderLod_hpp
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Shader level of detail of a set of objects, picked from their distance to the camera.
+    // Tier 0 is the full shading and every tier distance starts one cheaper tier. An object only
+    // changes tier once it is past the boundary by the hysteresis margin, so objects standing on
+    // a boundary do not switch back and forth.
+    class ShaderLod
+    {
+    public:
+        // distances in increasing order, tiers 1 to distances.size()
+        void Create(const std::vector<float>& distances, float hysteresis);
+        // the tier of every object from the closest point of its world space bounds
+        void Update(const std::vector<BoundingBox>& bounds, glm::vec3 cameraPosition);
+
+        int getTierCount();
+        int getTier(int object);
+        const std::vector<int>& getTiers();
+        // objects in the tier after the last update
+        int countObjects(int tier);
+        // flags the objects of the tier that are also set in objectMask, when given
+        void getTierMask(int tier, std::vector<bool>& mask, const std::vector<bool>* objectMask = nullptr);
+
+    private:
+        std::vector<float> distances;
+        float hysteresis = 0.0f;
+        std::vector<int> tiers;
+        std::vector<int> tierCounts;
+    };
+
+}
+
+#endif /* ShaderLod_hpp */
@@ -0,0 +1,132 @@
+#include "ShaderPermutations.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    void ShaderPermutations::Create(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+        const std::vector<std::string>& features, unsigned int featureMask,
+        const std::vector<std::string>& defines, std::function<void(gps::Shader)> initialize)
+    {
+        this->vertexShaderFileName = vertexShaderFileName;
+        this->fragmentShaderFileName = fragmentShaderFileName;
+        this->features = features;
+        this->featureMask = featureMask;
+        this->defines = defines;
+        this->initialize = initialize;
+    }
+
+    void ShaderPermutations::Request(unsigned int features)
+    {
+        unsigned int key = features & featureMask;
+        if (variants.find(key) != variants.end())
+            return;
+
+        std::vector<std::string> variantDefines = defines;
+        for (size_t i = 0; i < this->features.size(); i++) {
+            if (key & (1u << i)) {
+                variantDefines.push_back(this->features[i]);
+            }
+        }
+
+        Variant& variant = variants[key];
+        variant.ready = false;
+        variant.shader.beginLoading(vertexShaderFileName, fragmentShaderFileName, variantDefines);
+    }
+
+    void ShaderPermutations::Complete(unsigned int key, Variant& variant)
+    {
+        variant.ready = true;
+        variant.shader.useShaderProgram();
+        if (initialize) {
+            initialize(variant.shader);
+        }
+
+        std::cout << "Shader variant " << fragmentShaderFileName << " (";
+        bool first = true;
+        for (size_t i = 0; i < features.size(); i++) {
+            if (key & (1u << i)) {
+                std::cout << (first ? "" : " ") << features[i];
+                first = false;
+            }
+        }
+        std::cout << ") ready" << std::endl;
+    }
+
+    int ShaderPermutations::countFeatures(unsigned int features)
+    {
+        int count = 0;
+        for (; features; features &= features - 1) {
+            count++;
+        }
+        return count;
+    }
+
+    unsigned int ShaderPermutations::getReadyFeatures(unsigned int features)
+    {
+        unsigned int key = features & featureMask;
+        Request(key);
+
+        //poll every variant still compiling, the closest ready one wins
+        int bestCount = -1;
+        unsigned int bestKey = 0;
+        for (std::pair<const unsigned int, Variant>& variant : variants) {
+            if (!variant.second.ready && variant.second.shader.isReady()) {
+                Complete(variant.first, variant.second);
+            }
+            if (!variant.second.ready || (variant.first & ~key) != 0)
+                continue;
+            int count = countFeatures(variant.first);
+            if (count > bestCount) {
+                bestCount = count;
+                bestKey = variant.first;
+            }
+        }
+
+        if (bestCount < 0) {
+            get(0);
+            return 0;
+        }
+        return bestKey;
+    }
+
+    gps::Shader ShaderPermutations::get(unsigned int features)
+    {
+        unsigned int key = features & featureMask;
+        Request(key);
+
+        Variant& variant = variants[key];
+        if (!variant.ready) {
+            variant.shader.finishLoading();
+            Complete(key, variant);
+        }
+        return variant.shader;
+    }
+
+    bool ShaderPermutations::isComplete()
+    {
+        bool complete = true;
+        for (std::pair<const unsigned int, Variant>& variant : variants) {
+            if (!variant.second.ready && variant.second.shader.isReady()) {
+                Complete(variant.first, variant.second);
+            }
+            complete = complete && variant.second.ready;
+        }
+        return complete;
+    }
+
+    void ShaderPermutations::Delete()
+    {
+        for (std::pair<const unsigned int, Variant>& variant : variants) {
+            variant.second.shader.finishLoading();
+            glDeleteProgram(variant.second.shader.shaderProgram);
+        }
+        variants.clear();
+    }
+
+    int ShaderPermutations::getVariantCount()
+    {
+        return (int)variants.size();
+    }
+
+}
@@ -0,0 +1,63 @@
+#ifndef ShaderPermutations_hpp
+#define ShaderPermutations_hpp
+
+#include <GL/glew.h>
+
+#include "Shader.hpp"
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Variants of one shader pair, specialised at compile time by feature #defines instead of
+    // uniform branches. A variant is compiled the first time its feature bitmask is asked for
+    // and cached, so disabled features cost no instructions and no uniforms. Variants compile in
+    // the background, and a variant with fewer features stands in until they are ready.
+    class ShaderPermutations
+    {
+    public:
+        // bit i of a feature bitmask defines features[i], bits outside featureMask are ignored so
+        // features the shader does not use never produce duplicate variants
+        // defines are added to every variant, initialize sets the uniforms that never change
+        void Create(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+            const std::vector<std::string>& features, unsigned int featureMask,
+            const std::vector<std::string>& defines = std::vector<std::string>(),
+            std::function<void(gps::Shader)> initialize = nullptr);
+        // starts compiling the variant in the background, unless it is compiled or compiling
+        void Request(unsigned int features);
+        // the features of the closest variant ready to draw: the one asked for, which is requested,
+        // or else the ready variant with the most of its features and no others
+        // when none is ready it waits for the variant without features
+        unsigned int getReadyFeatures(unsigned int features);
+        // the variant for the features, waiting for it to compile
+        gps::Shader get(unsigned int features);
+        // polls the variants still compiling, true once every requested variant is ready
+        bool isComplete();
+        void Delete();
+
+        int getVariantCount();
+
+    private:
+        std::string vertexShaderFileName;
+        std::string fragmentShaderFileName;
+        std::vector<std::string> features;
+        unsigned int featureMask = 0;
+        std::vector<std::string> defines;
+        std::function<void(gps::Shader)> initialize;
+        struct Variant {
+            gps::Shader shader;
+            bool ready;
+        };
+        std::map<unsigned int, Variant> variants;
+
+        // finishes a variant whose program is done, sets its uniforms
+        void Complete(unsigned int key, Variant& variant);
+        int countFeatures(unsigned int features);
+    };
+
+}
+
+#endif /* ShaderPermutations_hpp */
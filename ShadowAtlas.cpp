@@ -0,0 +1,144 @@
+#include "ShadowAtlas.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    void ShadowAtlas::Create(int size, int minTileSize)
+    {
+        this->size = size;
+        this->minTileSize = minTileSize;
+
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24,
+            size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        //the whole atlas starts as one free block
+        freeBlocks.assign(getLevel(minTileSize) + 1, std::vector<glm::ivec2>());
+        freeBlocks[0].push_back(glm::ivec2(0, 0));
+    }
+
+    int ShadowAtlas::getLevel(int tileSize)
+    {
+        int level = 0;
+        for (int blockSize = size; blockSize > tileSize && blockSize > minTileSize; blockSize /= 2) {
+            level++;
+        }
+        return level;
+    }
+
+    bool ShadowAtlas::Allocate(int tileSize, ShadowTile& tile)
+    {
+        int level = getLevel(tileSize);
+        glm::ivec2 block;
+        if (!AllocateBlock(level, block))
+            return false;
+
+        tile.x = block.x;
+        tile.y = block.y;
+        tile.size = size >> level;
+        return true;
+    }
+
+    bool ShadowAtlas::AllocateBlock(int level, glm::ivec2& block)
+    {
+        if (!freeBlocks[level].empty()) {
+            block = freeBlocks[level].back();
+            freeBlocks[level].pop_back();
+            return true;
+        }
+        if (level == 0)
+            return false;
+
+        //split a larger block, keeping three of its quarters free
+        glm::ivec2 parent;
+        if (!AllocateBlock(level - 1, parent))
+            return false;
+        int half = size >> level;
+        freeBlocks[level].push_back(parent + glm::ivec2(half, half));
+        freeBlocks[level].push_back(parent + glm::ivec2(0, half));
+        freeBlocks[level].push_back(parent + glm::ivec2(half, 0));
+        block = parent;
+        return true;
+    }
+
+    void ShadowAtlas::Free(ShadowTile& tile)
+    {
+        if (tile.size == 0)
+            return;
+        FreeBlock(getLevel(tile.size), glm::ivec2(tile.x, tile.y));
+        tile.size = 0;
+    }
+
+    void ShadowAtlas::FreeBlock(int level, glm::ivec2 block)
+    {
+        std::vector<glm::ivec2>& blocks = freeBlocks[level];
+        if (level > 0) {
+            //merge back into the parent once all four quarters are free
+            int blockSize = size >> level;
+            glm::ivec2 parent(block.x & ~(2 * blockSize - 1), block.y & ~(2 * blockSize - 1));
+            int freeSiblings = 0;
+            for (glm::ivec2& other : blocks) {
+                if ((other.x & ~(2 * blockSize - 1)) == parent.x && (other.y & ~(2 * blockSize - 1)) == parent.y)
+                    freeSiblings++;
+            }
+            if (freeSiblings == 3) {
+                blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [&](glm::ivec2 other) {
+                    return (other.x & ~(2 * blockSize - 1)) == parent.x && (other.y & ~(2 * blockSize - 1)) == parent.y;
+                }), blocks.end());
+                FreeBlock(level - 1, parent);
+                return;
+            }
+        }
+        blocks.push_back(block);
+    }
+
+    void ShadowAtlas::BeginTile(ShadowTile tile)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(tile.x, tile.y, tile.size, tile.size);
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(tile.x, tile.y, tile.size, tile.size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    void ShadowAtlas::End()
+    {
+        glDisable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void ShadowAtlas::Delete()
+    {
+        if (framebuffer) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteTextures(1, &depthTexture);
+            framebuffer = 0;
+            depthTexture = 0;
+        }
+    }
+
+    GLuint ShadowAtlas::getTexture()
+    {
+        return depthTexture;
+    }
+
+    glm::vec4 ShadowAtlas::getTileRect(ShadowTile tile)
+    {
+        return glm::vec4((float)tile.x / size, (float)tile.y / size, (float)tile.size / size, tile.size > 0 ? 1.0f : 0.0f);
+    }
+
+}
@@ -0,0 +1,52 @@
+#ifndef ShadowAtlas_hpp
+#define ShadowAtlas_hpp
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // square region of the atlas, size 0 when nothing is allocated
+    struct ShadowTile {
+        int x;
+        int y;
+        int size;
+    };
+
+    // One depth texture shared by the shadow maps of many lights. Power of two tiles are handed
+    // out by a quadtree allocator: a free block is split in four until it fits, and four free
+    // siblings are merged back into their parent.
+    class ShadowAtlas
+    {
+    public:
+        void Create(int size, int minTileSize);
+        // false when no free block of the size is left
+        bool Allocate(int tileSize, ShadowTile& tile);
+        void Free(ShadowTile& tile);
+        // restricts drawing to the tile and clears its depth
+        void BeginTile(ShadowTile tile);
+        void End();
+        void Delete();
+
+        GLuint getTexture();
+        // offset in xy and scale in z, mapping [0, 1] texture coordinates into the tile
+        glm::vec4 getTileRect(ShadowTile tile);
+
+    private:
+        GLuint framebuffer = 0;
+        GLuint depthTexture = 0;
+        int size = 0;
+        int minTileSize = 0;
+        // origins of the free blocks, by level, level 0 being the whole atlas
+        std::vector<std::vector<glm::ivec2>> freeBlocks;
+
+        int getLevel(int tileSize);
+        bool AllocateBlock(int level, glm::ivec2& block);
+        void FreeBlock(int level, glm::ivec2 block);
+    };
+
+}
+
+#endif /* ShadowAtlas_hpp */
@@ -0,0 +1,72 @@
+#include "ShadowMap.hpp"
+
+namespace gps {
+
+    void ShadowMap::Create(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+
+        //generate FBO ID
+        glGenFramebuffers(1, &framebuffer);
+
+        //create depth texture for FBO
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
+            width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        // everything outside the map is lit
+        float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        //attach texture to FBO
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void ShadowMap::Begin()
+    {
+        glViewport(0, 0, width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    void ShadowMap::End()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void ShadowMap::Delete()
+    {
+        if (framebuffer) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteTextures(1, &depthTexture);
+            framebuffer = 0;
+            depthTexture = 0;
+        }
+    }
+
+    GLuint ShadowMap::getTexture()
+    {
+        return depthTexture;
+    }
+
+    int ShadowMap::getWidth()
+    {
+        return width;
+    }
+
+    int ShadowMap::getHeight()
+    {
+        return height;
+    }
+
+}
@@ -0,0 +1,31 @@
+#ifndef ShadowMap_hpp
+#define ShadowMap_hpp
+
+#include <GL/glew.h>
+
+namespace gps {
+
+    // Depth texture attached to its own framebuffer, rendered from a light's point of view
+    class ShadowMap
+    {
+    public:
+        void Create(int width, int height);
+        // binds the framebuffer, sets the viewport and clears the depth
+        void Begin();
+        void End();
+        void Delete();
+
+        GLuint getTexture();
+        int getWidth();
+        int getHeight();
+
+    private:
+        GLuint framebuffer = 0;
+        GLuint depthTexture = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+}
+
+#endif /* ShadowMap_hpp */
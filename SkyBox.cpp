@@ -7,6 +7,7 @@
 //
 
 #include "SkyBox.hpp"
+#include "RenderStats.hpp"
 
 namespace gps {
     
@@ -37,6 +38,8 @@ namespace gps {
         glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
+        RenderStats::countTextureBinds(1);
+        RenderStats::countDraw(GL_TRIANGLES, 36);
         glBindVertexArray(0);
         
         glDepthFunc(GL_LESS);
@@ -0,0 +1,215 @@
+#include "TextOverlay.hpp"
+#include "RenderStats.hpp"
+
+namespace gps {
+
+    namespace {
+
+        const int firstChar = 32;
+        const int charCount = 64;
+        const int glyphWidth = 5;
+        const int glyphHeight = 7;
+        // a blank column and row around each glyph separate the characters
+        const int cellWidth = glyphWidth + 1;
+        const int cellHeight = glyphHeight + 1;
+        const int atlasColumns = 16;
+        const int atlasRows = charCount / atlasColumns;
+
+        // rows from the top, bit 4 is the leftmost pixel
+        const unsigned char glyphs[charCount][glyphHeight] = {
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+        { 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 }, // !
+        { 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "
+        { 0x0A, 0x1F, 0x0A, 0x0A, 0x0A, 0x1F, 0x0A }, // #
+        { 0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04 }, // $
+        { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, // %
+        { 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D }, // &
+        { 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '
+        { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 }, // (
+        { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 }, // )
+        { 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00 }, // *
+        { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 }, // +
+        { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 }, // ,
+        { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }, // -
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C }, // .
+        { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, // /
+        { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E }, // 0
+        { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E }, // 1
+        { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F }, // 2
+        { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E }, // 3
+        { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 }, // 4
+        { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E }, // 5
+        { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E }, // 6
+        { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, // 7
+        { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E }, // 8
+        { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C }, // 9
+        { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 }, // :
+        { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08 }, // ;
+        { 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 }, // <
+        { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 }, // =
+        { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 }, // >
+        { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 }, // ?
+        { 0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E }, // @
+        { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, // A
+        { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E }, // B
+        { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E }, // C
+        { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C }, // D
+        { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F }, // E
+        { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 }, // F
+        { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F }, // G
+        { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, // H
+        { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, // I
+        { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C }, // J
+        { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, // K
+        { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F }, // L
+        { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 }, // M
+        { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 }, // N
+        { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // O
+        { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 }, // P
+        { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D }, // Q
+        { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 }, // R
+        { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E }, // S
+        { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // T
+        { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // U
+        { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 }, // V
+        { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A }, // W
+        { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 }, // X
+        { 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04 }, // Y
+        { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F }, // Z
+        { 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E }, // [
+        { 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 }, // backslash
+        { 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E }, // ]
+        { 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00 }, // ^
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F }, // _
+        };
+
+    }
+
+    void TextOverlay::Create()
+    {
+        InitFont();
+
+        glGenVertexArrays(1, &textVAO);
+        glGenBuffers(1, &textVBO);
+        glBindVertexArray(textVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, textVBO);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid*)(2 * sizeof(GLfloat)));
+        glEnableVertexAttribArray(1);
+        glBindVertexArray(0);
+    }
+
+    void TextOverlay::InitFont()
+    {
+        const int atlasWidth = atlasColumns * cellWidth;
+        const int atlasHeight = atlasRows * cellHeight;
+        //texel row 0 is the top of the first row of cells
+        std::vector<unsigned char> texels(atlasWidth * atlasHeight, 0);
+        for (int c = 0; c < charCount; c++) {
+            int cellX = (c % atlasColumns) * cellWidth;
+            int cellY = (c / atlasColumns) * cellHeight;
+            for (int row = 0; row < glyphHeight; row++) {
+                for (int column = 0; column < glyphWidth; column++) {
+                    if (glyphs[c][row] & (0x10 >> column))
+                        texels[(cellY + row) * atlasWidth + cellX + column] = 255;
+                }
+            }
+        }
+
+        glGenTextures(1, &fontTexture);
+        glBindTexture(GL_TEXTURE_2D, fontTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlasWidth, atlasHeight, 0, GL_RED, GL_UNSIGNED_BYTE, texels.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        //whole texels per screen pixel block, no blurring between them
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void TextOverlay::Draw(gps::Shader textShader, const std::vector<std::string>& lines,
+        int screenWidth, int screenHeight, int scale)
+    {
+        vertices.clear();
+        float pixelWidth = 2.0f / screenWidth;
+        float pixelHeight = 2.0f / screenHeight;
+        float texelWidth = 1.0f / (atlasColumns * cellWidth);
+        float texelHeight = 1.0f / (atlasRows * cellHeight);
+
+        for (size_t line = 0; line < lines.size(); line++) {
+            //a blank cell of margin to the left and above
+            float top = 1.0f - (line + 1) * cellHeight * scale * pixelHeight;
+            float bottom = top - cellHeight * scale * pixelHeight;
+            for (size_t i = 0; i < lines[line].size(); i++) {
+                int c = (unsigned char)lines[line][i];
+                if (c >= 'a' && c <= 'z')
+                    c -= 'a' - 'A';
+                if (c < firstChar || c >= firstChar + charCount)
+                    c = '?';
+                c -= firstChar;
+
+                float left = -1.0f + (i + 1) * cellWidth * scale * pixelWidth;
+                float right = left + cellWidth * scale * pixelWidth;
+                float u0 = (c % atlasColumns) * cellWidth * texelWidth;
+                float u1 = u0 + cellWidth * texelWidth;
+                float v0 = (c / atlasColumns) * cellHeight * texelHeight;
+                float v1 = v0 + cellHeight * texelHeight;
+
+                GLfloat quad[] = {
+                    left, bottom, u0, v1,
+                    right, bottom, u1, v1,
+                    right, top, u1, v0,
+                    left, bottom, u0, v1,
+                    right, top, u1, v0,
+                    left, top, u0, v0
+                };
+                vertices.insert(vertices.end(), quad, quad + 24);
+            }
+        }
+        if (vertices.empty())
+            return;
+
+        GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+        GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+        GLboolean blend = glIsEnabled(GL_BLEND);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        textShader.useShaderProgram();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, fontTexture);
+        RenderStats::countTextureBinds(1);
+        glUniform1i(glGetUniformLocation(textShader.shaderProgram, "font"), 0);
+
+        glBindVertexArray(textVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, textVBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STREAM_DRAW);
+        GLsizei vertexCount = (GLsizei)(vertices.size() / 4);
+        glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+        RenderStats::countDraw(GL_TRIANGLES, vertexCount);
+        glBindVertexArray(0);
+
+        if (depthTest)
+            glEnable(GL_DEPTH_TEST);
+        if (cullFace)
+            glEnable(GL_CULL_FACE);
+        if (!blend)
+            glDisable(GL_BLEND);
+    }
+
+    void TextOverlay::Delete()
+    {
+        if (textVAO) {
+            glDeleteVertexArrays(1, &textVAO);
+            glDeleteBuffers(1, &textVBO);
+            glDeleteTextures(1, &fontTexture);
+            textVAO = 0;
+        }
+    }
+
+}
@@ -0,0 +1,38 @@
+#ifndef TextOverlay_hpp
+#define TextOverlay_hpp
+
+#include <GL/glew.h>
+
+#include "Shader.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Lines of text drawn over the frame with a built in 5x7 bitmap font, one texel per font pixel
+    // scaled up by a whole factor, each character on a translucent dark cell so it stays readable
+    // over the scene. Covers printable ASCII up to '_', lowercase letters are drawn as uppercase.
+    class TextOverlay
+    {
+    public:
+        void Create();
+        // draws the lines from the top left corner of the bound framebuffer, screenWidth by screenHeight
+        // pixels, with textShader (font sampler on unit 0); depth test, culling and blending are restored
+        void Draw(gps::Shader textShader, const std::vector<std::string>& lines,
+            int screenWidth, int screenHeight, int scale);
+        void Delete();
+
+    private:
+        GLuint fontTexture = 0;
+        GLuint textVAO = 0;
+        GLuint textVBO = 0;
+        // x, y in clip space and u, v per vertex, six vertices per character
+        std::vector<GLfloat> vertices;
+
+        void InitFont();
+    };
+
+}
+
+#endif /* TextOverlay_hpp */
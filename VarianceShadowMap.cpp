@@ -0,0 +1,134 @@
+#include "VarianceShadowMap.hpp"
+#include "RenderStats.hpp"
+
+#include <cmath>
+
+namespace gps {
+
+    // moments of the farthest depth, must match shaders/shadowMoments.frag
+    static void farthestMoments(GLfloat moments[4])
+    {
+        const float positiveExponent = 40.0f;
+        const float negativeExponent = 5.0f;
+        moments[0] = std::exp(positiveExponent);
+        moments[1] = moments[0] * moments[0];
+        moments[2] = -std::exp(-negativeExponent);
+        moments[3] = moments[2] * moments[2];
+    }
+
+    void VarianceShadowMap::Create(int size)
+    {
+        this->size = size;
+
+        GLfloat moments[4];
+        farthestMoments(moments);
+
+        //mipmapped moments, everything outside the map is lit
+        glGenTextures(1, &momentTexture);
+        glBindTexture(GL_TEXTURE_2D, momentTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, size, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, moments);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        //intermediate target of the horizontal blur
+        glGenTextures(1, &blurTexture);
+        glBindTexture(GL_TEXTURE_2D, blurTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, size, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenRenderbuffers(1, &depthRenderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, momentTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+
+        glGenFramebuffers(1, &blurFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, blurFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurTexture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        //the blur draws one triangle generated in the vertex shader
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    void VarianceShadowMap::Begin()
+    {
+        GLfloat moments[4];
+        farthestMoments(moments);
+
+        glViewport(0, 0, size, size);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glClearBufferfv(GL_COLOR, 0, moments);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    void VarianceShadowMap::End()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void VarianceShadowMap::Filter(gps::Shader blurShader)
+    {
+        blurShader.useShaderProgram();
+        glUniform1i(glGetUniformLocation(blurShader.shaderProgram, "source"), 0);
+
+        glDisable(GL_DEPTH_TEST);
+        glViewport(0, 0, size, size);
+        glBindVertexArray(emptyVAO);
+        glActiveTexture(GL_TEXTURE0);
+
+        BlurPass(blurShader, momentTexture, blurFramebuffer, 1.0f / size, 0.0f);
+        BlurPass(blurShader, blurTexture, framebuffer, 0.0f, 1.0f / size);
+
+        glBindTexture(GL_TEXTURE_2D, momentTexture);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        RenderStats::countTextureBinds(2);
+
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    void VarianceShadowMap::BlurPass(gps::Shader blurShader, GLuint source, GLuint targetFramebuffer, float directionX, float directionY)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+        glBindTexture(GL_TEXTURE_2D, source);
+        glUniform2f(glGetUniformLocation(blurShader.shaderProgram, "direction"), directionX, directionY);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        RenderStats::countTextureBinds(1);
+        RenderStats::countDraw(GL_TRIANGLES, 3);
+    }
+
+    void VarianceShadowMap::Delete()
+    {
+        if (framebuffer) {
+            glDeleteVertexArrays(1, &emptyVAO);
+            glDeleteFramebuffers(1, &blurFramebuffer);
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(1, &depthRenderbuffer);
+            glDeleteTextures(1, &blurTexture);
+            glDeleteTextures(1, &momentTexture);
+            framebuffer = 0;
+            momentTexture = 0;
+        }
+    }
+
+    GLuint VarianceShadowMap::getTexture()
+    {
+        return momentTexture;
+    }
+
+}
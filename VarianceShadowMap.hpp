@@ -0,0 +1,39 @@
+#ifndef VarianceShadowMap_hpp
+#define VarianceShadowMap_hpp
+
+#include <GL/glew.h>
+
+#include "Shader.hpp"
+
+namespace gps {
+
+    // Exponential variance shadow map: stores moments of the warped light depth instead of the
+    // depth itself, so after a blur and mipmapping one filtered fetch gives a soft shadow.
+    class VarianceShadowMap
+    {
+    public:
+        void Create(int size);
+        // binds the moment target, sets the viewport and clears it to the farthest depth
+        void Begin();
+        void End();
+        // separable blur of the moments, then rebuilds the mip chain
+        void Filter(gps::Shader blurShader);
+        void Delete();
+
+        GLuint getTexture();
+
+    private:
+        int size = 0;
+        GLuint framebuffer = 0;
+        GLuint depthRenderbuffer = 0;
+        GLuint momentTexture = 0;
+        GLuint blurFramebuffer = 0;
+        GLuint blurTexture = 0;
+        GLuint emptyVAO = 0;
+
+        void BlurPass(gps::Shader blurShader, GLuint source, GLuint targetFramebuffer, float directionX, float directionY);
+    };
+
+}
+
+#endif /* VarianceShadowMap_hpp */
@@ -1,7 +1,26 @@
 #include "Window.h"
 
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 namespace gps {
 
+    namespace {
+
+        //framebuffer 0 is the window's, headless it is redirected to the offscreen one so the
+        //passes that return to the window need no changes
+        GLuint headlessTarget = 0;
+        PFNGLBINDFRAMEBUFFERPROC originalBindFramebuffer;
+
+        void GLAPIENTRY bindHeadlessFramebuffer(GLenum target, GLuint framebuffer)
+        {
+            originalBindFramebuffer(target, framebuffer ? framebuffer : headlessTarget);
+        }
+
+    }
+
     void Window::Create(int width, int height, const char *title) {
         if (!glfwInit()) {
             throw std::runtime_error("Could not start GLFW3!");
@@ -19,6 +38,11 @@ namespace gps {
         // for multisampling/antialising
         glfwWindowHint(GLFW_SAMPLES, 4);
 
+#ifdef HEADLESS_EGL
+        // GLEW is built for EGL in this configuration, the window's context has to be one too
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#endif
+
         this->window = glfwCreateWindow(width, height, title, NULL, NULL);
         if (!this->window) {
             throw std::runtime_error("Could not create GLFW3 window!");
@@ -30,7 +54,14 @@ namespace gps {
 
         // start GLEW extension handler
         glewExperimental = GL_TRUE;
-        glewInit();
+        GLenum glewStatus = glewInit();
+        if (glewStatus != GLEW_OK) {
+            glfwDestroyWindow(window);
+            this->window = NULL;
+            glfwTerminate();
+            throw std::runtime_error(std::string("Could not load OpenGL through GLEW on the window's context: ") +
+                (const char*)glewGetErrorString(glewStatus));
+        }
 
         // get version info
         const GLubyte* renderer = glGetString(GL_RENDERER); // get renderer string
@@ -42,7 +73,92 @@ namespace gps {
         glfwGetFramebufferSize(window, &this->dimensions.width, &this->dimensions.height);
     }
 
+    void Window::CreateHeadless(int width, int height) {
+#ifdef HEADLESS_EGL
+        //no display server: Mesa's surfaceless platform, llvmpipe on machines without a GPU
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        EGLDisplay display = getPlatformDisplay ?
+            getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+            throw std::runtime_error("Could not open a surfaceless EGL display!");
+        }
+        eglBindAPI(EGL_OPENGL_API);
+
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 1,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE,
+            EGL_NONE
+        };
+        //no surface at all, the context draws into framebuffer objects only
+        EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            eglTerminate(display);
+            throw std::runtime_error("Could not create a headless OpenGL 4.1 context!");
+        }
+        //GLEW has to be built with GLEW_EGL, a GLX build finds no GLX display and loads nothing
+        glewExperimental = GL_TRUE;
+        GLenum glewStatus = glewInit();
+        if (glewStatus != GLEW_OK) {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(display, context);
+            eglTerminate(display);
+            throw std::runtime_error(std::string("Could not load OpenGL through GLEW on the headless context: ") +
+                (const char*)glewGetErrorString(glewStatus));
+        }
+        this->eglDisplay = display;
+        this->eglContext = context;
+        this->headless = true;
+
+        const GLubyte* renderer = glGetString(GL_RENDERER);
+        const GLubyte* version = glGetString(GL_VERSION);
+        std::cout << "Renderer: " << renderer << " (headless)" << std::endl;
+        std::cout << "OpenGL version: " << version << std::endl;
+
+        //sRGB colour like the window's, single sampled
+        glGenRenderbuffers(1, &headlessColorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, headlessColorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, width, height);
+        glGenRenderbuffers(1, &headlessDepthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, headlessDepthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &headlessFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, headlessFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headlessColorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, headlessDepthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error("Could not create the headless framebuffer!");
+        }
+
+        headlessTarget = headlessFramebuffer;
+        originalBindFramebuffer = __glewBindFramebuffer;
+        __glewBindFramebuffer = bindHeadlessFramebuffer;
+
+        this->dimensions.width = width;
+        this->dimensions.height = height;
+#else
+        throw std::runtime_error("Headless rendering needs a build with HEADLESS_EGL!");
+#endif
+    }
+
     void Window::Delete() {
+        if (headless) {
+#ifdef HEADLESS_EGL
+            __glewBindFramebuffer = originalBindFramebuffer;
+            glDeleteFramebuffers(1, &headlessFramebuffer);
+            glDeleteRenderbuffers(1, &headlessColorBuffer);
+            glDeleteRenderbuffers(1, &headlessDepthBuffer);
+            eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(eglDisplay, eglContext);
+            eglTerminate(eglDisplay);
+#endif
+            headless = false;
+            return;
+        }
         if (window)
             glfwDestroyWindow(window);
         //close GL context and any other GLFW resources
@@ -60,4 +176,69 @@ namespace gps {
     void Window::setWindowDimensions(WindowDimensions dimensions) {
         this->dimensions = dimensions;
     }
+
+    bool Window::isHeadless() {
+        return this->headless;
+    }
+
+    bool Window::shouldClose() {
+        return headless ? closeRequested : glfwWindowShouldClose(window) != 0;
+    }
+
+    void Window::setShouldClose(bool close) {
+        if (headless)
+            closeRequested = close;
+        else
+            glfwSetWindowShouldClose(window, close ? GL_TRUE : GL_FALSE);
+    }
+
+    void Window::SwapBuffers() {
+        //nothing to present headless, the frame stays in the framebuffer object
+        if (headless)
+            glFlush();
+        else
+            glfwSwapBuffers(window);
+    }
+
+    void Window::PollEvents() {
+        if (!headless)
+            glfwPollEvents();
+    }
+
+    GLenum Window::getDepthFormat() {
+        //the headless depth renderbuffer, its format is known
+        if (headless)
+            return GL_DEPTH_COMPONENT24;
+
+        GLint depthBits = 0;
+        GLint stencilBits = 0;
+        GLint componentType = GL_UNSIGNED_NORMALIZED;
+        GLint objectType = GL_NONE;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &objectType);
+        if (objectType != GL_NONE) {
+            glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+            glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &componentType);
+        }
+        objectType = GL_NONE;
+        glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &objectType);
+        if (objectType != GL_NONE)
+            glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+
+        if (componentType == GL_FLOAT)
+            return stencilBits > 0 ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+        if (stencilBits > 0)
+            return GL_DEPTH24_STENCIL8;
+        if (depthBits == 16)
+            return GL_DEPTH_COMPONENT16;
+        return depthBits == 32 ? GL_DEPTH_COMPONENT32 : GL_DEPTH_COMPONENT24;
+    }
+
+    void Window::ReadPixels(std::vector<unsigned char>& pixels) {
+        pixels.resize((size_t)dimensions.width * dimensions.height * 3);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, dimensions.width, dimensions.height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    }
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <GLFW/glfw3.h>
 #include <stdexcept>
 #include <iostream>
+#include <vector>
 
 struct WindowDimensions {
     int width;
@@ -17,15 +18,38 @@ namespace gps {
 
     public:
         void Create(int width=800, int height=600, const char *title="OpenGL Project");
+        //offscreen GL 4.1 core context without a display, drawing into a framebuffer object that
+        //stands in for the window's framebuffer 0; needs a build with HEADLESS_EGL
+        void CreateHeadless(int width, int height);
         void Delete();
 
+        //null when headless
         GLFWwindow* getWindow();
         WindowDimensions getWindowDimensions();
         void setWindowDimensions(WindowDimensions dimensions);
 
+        bool isHeadless();
+        bool shouldClose();
+        void setShouldClose(bool close);
+        void SwapBuffers();
+        void PollEvents();
+        //RGB pixels of the frame drawn so far, bottom row first, before SwapBuffers
+        void ReadPixels(std::vector<unsigned char>& pixels);
+        //internal format of framebuffer 0's depth buffer, for textures it is blitted into
+        GLenum getDepthFormat();
+
     private:
         WindowDimensions dimensions;
-        GLFWwindow *window;
+        GLFWwindow *window = nullptr;
+
+        bool headless = false;
+        bool closeRequested = false;
+        //EGLDisplay and EGLContext, kept opaque so the header does not need EGL
+        void *eglDisplay = nullptr;
+        void *eglContext = nullptr;
+        GLuint headlessFramebuffer = 0;
+        GLuint headlessColorBuffer = 0;
+        GLuint headlessDepthBuffer = 0;
     };
 }
 
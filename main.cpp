@@ -13,11 +13,75 @@
 #include "Model3D.hpp"
 #include "Mesh.hpp"
 #include "SkyBox.hpp"
+#include "OcclusionCuller.hpp"
+#include "PotentiallyVisibleSet.hpp"
+#include "ShadowMap.hpp"
+#include "CascadedShadowMap.hpp"
+#include "Frustum.hpp"
+#include "DepthReduction.hpp"
+#include "VarianceShadowMap.hpp"
+#include "ShadowAtlas.hpp"
+#include "LightClusters.hpp"
+#include "GBuffer.hpp"
+#include "ShaderPermutations.hpp"
+#include "ShaderLod.hpp"
+#include "GpuProfiler.hpp"
+#include "CpuProfiler.hpp"
+#include "RenderStats.hpp"
+#include "TextOverlay.hpp"
+#include "CameraPath.hpp"
+#include "BenchmarkRecorder.hpp"
+#include "InputLog.hpp"
+#include "PerfGate.hpp"
 
 #include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
 
 const unsigned int SHADOW_WIDTH = 4096;
 const unsigned int SHADOW_HEIGHT = 4096;
+// the car only needs a small map fitted around it
+const unsigned int DYNAMIC_SHADOW_SIZE = 1024;
+// cascades share one texture array, with a smaller layer per cascade
+const int CASCADE_COUNT = 4;
+const int CASCADE_SIZE = 1024;
+// shadows fade out past this distance from the camera
+const float SHADOW_DISTANCE = 150.0f;
+// soft shadow maps store filtered moments, so they can be much smaller
+const int MOMENT_SHADOW_SIZE = 1024;
+const int DYNAMIC_MOMENT_SHADOW_SIZE = 512;
+// street lamp shadows share one atlas, tiles are sized by how much of the screen a lamp covers
+const int LAMP_ATLAS_SIZE = 2048;
+const int LAMP_MIN_TILE_SIZE = 64;
+const int LAMP_MAX_TILE_SIZE = 512;
+// lamp tiles redrawn per frame, the others wait for the next frames
+const int LAMP_UPDATES_PER_FRAME = 4;
+// size of the StreetLamps block in basic.frag
+const int MAX_STREET_LAMPS = 32;
+// clusters of the camera frustum for the night lights, 16x9 tiles and 24 depth slices
+const int CLUSTER_TILES_X = 16;
+const int CLUSTER_TILES_Y = 9;
+const int CLUSTER_SLICES = 24;
+// shader LOD: past these distances objects drop the specular terms, then the shadow lookup and
+// spotlight (shadows fade out at SHADOW_DISTANCE anyway), then are lit and fogged per vertex
+const std::vector<float> SHADER_LOD_DISTANCES = { 75.0f, SHADOW_DISTANCE, 300.0f };
+const float SHADER_LOD_HYSTERESIS = 5.0f;
+// the statistics printed to the console are reported once every this many frames, about two seconds at 60 fps
+const int STATS_REPORT_FRAMES = 120;
+// frames of GPU timings kept for the statistics of each pass
+const int GPU_PROFILER_HISTORY = 120;
+// screen pixels per font pixel of the render statistics overlay
+const int STATS_OVERLAY_SCALE = 2;
+// the benchmark path is played at a fixed step per frame, after frames that are not recorded
+const float BENCHMARK_TIMESTEP = 1.0f / 60.0f;
+const int BENCHMARK_WARMUP_FRAMES = 60;
+// a headless run without --frames or a replay has no input to end it, it stops after these frames
+const int HEADLESS_DEFAULT_FRAMES = 60;
 
 // window
 gps::Window myWindow;
@@ -26,19 +90,14 @@ gps::Window myWindow;
 glm::mat4 model;
 glm::mat4 view;
 glm::mat4 projection;
+// projection of the scene shaders, projection is reused for the skybox
+glm::mat4 sceneProjection;
 glm::mat3 normalMatrix;
 
 // light parameters
 glm::vec3 lightDir;
 glm::vec3 lightColor;
 
-// shader uniform locations
-GLint modelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-GLint lightDirLoc;
-GLint lightColorLoc;
 glm::mat4 lightRotation;
 
 // camera
@@ -62,10 +121,47 @@ gps::Model3D carBody;
 GLfloat angle;
 GLfloat lightAngle;
 
+// car animation
+bool carAnimationBool = false;
+float wheelAngle = 0.0f;
+float carDistance = 0.0f;
+
 // shaders
-gps::Shader myBasicShader;
+// the scene shaders are compiled per combination of the features in use, see getSceneFeatures
+gps::ShaderPermutations basicShaders;
 gps::Shader lightShader;
 gps::Shader depthMapShader;
+gps::Shader depthPrepassShader;
+gps::Shader depthReduceShader;
+gps::Shader momentShader;
+gps::Shader blurShader;
+gps::ShaderPermutations gBufferShaders;
+gps::ShaderPermutations deferredShaders;
+// startup is reported again once the scene variants compiling in the background are all ready
+std::chrono::steady_clock::time_point shaderStartupStart;
+bool shaderStartupReported = false;
+
+// compile time features of the scene shaders, bit i defines shaderFeatureNames[i]
+enum SHADER_FEATURE {
+    FEATURE_FOG = 1 << 0,
+    FEATURE_SPOTLIGHT = 1 << 1,
+    FEATURE_CLUSTERED_LIGHTS = 1 << 2,
+    FEATURE_CACHED_SHADOWS = 1 << 3,
+    FEATURE_CASCADED_SHADOWS = 1 << 4,
+    FEATURE_SOFT_SHADOWS = 1 << 5,
+    // cheaper shading of distant objects, see getLodFeatures
+    FEATURE_NO_SPECULAR = 1 << 6,
+    FEATURE_VERTEX_LIGHTING = 1 << 7,
+    // transforms per fragment as before they moved to basic.vert, the --shader-bench reference
+    FEATURE_PER_FRAGMENT_TRANSFORMS = 1 << 8
+};
+const std::vector<std::string> shaderFeatureNames = {
+    "FOG", "SPOTLIGHT", "CLUSTERED_LIGHTS", "CACHED_SHADOWS", "CASCADED_SHADOWS", "SOFT_SHADOWS",
+    "NO_SPECULAR", "VERTEX_LIGHTING", "PER_FRAGMENT_TRANSFORMS"
+};
+// the G-buffer pass only resolves shadows, the composite only lights
+const unsigned int SHADOW_FEATURES = FEATURE_CACHED_SHADOWS | FEATURE_CASCADED_SHADOWS | FEATURE_SOFT_SHADOWS;
+const unsigned int LIGHTING_FEATURES = FEATURE_FOG | FEATURE_SPOTLIGHT | FEATURE_CLUSTERED_LIGHTS;
 
 //skybox
 std::vector<const GLchar*> faces;
@@ -73,8 +169,87 @@ gps::SkyBox mySkyBox;
 gps::Shader skyboxShader;
 
 // shadows
-GLuint shadowMapFBO;
-GLuint depthMapTexture;
+// the city is static, its map is only rebuilt when the sun moves
+gps::ShadowMap staticShadowMap;
+bool staticShadowValid = false;
+GLfloat staticShadowLightAngle;
+// the car is redrawn every frame into a small map of its own
+gps::ShadowMap dynamicShadowMap;
+// alternatively, cascades following the camera hold every caster, either split over a fixed
+// distance or fitted to the depth range visible on screen (sample distribution shadow maps)
+enum SHADOW_MODE { SHADOW_CACHED, SHADOW_CASCADED, SHADOW_SAMPLE_DISTRIBUTION, SHADOW_EXPONENTIAL };
+SHADOW_MODE shadowMode = SHADOW_CACHED;
+// without shadows no map is drawn and no variant samples one
+bool shadowsOn = true;
+gps::CascadedShadowMap cascadedShadowMap;
+gps::DepthReduction depthRange;
+// the splits and light view the next depth reduction bins the visible samples with
+gps::DepthReduction::Partitions depthPartitions = {};
+// or soft shadows: the cached city and car maps as blurred exponential variance maps
+gps::VarianceShadowMap staticMomentMap;
+bool staticMomentValid = false;
+GLfloat staticMomentLightAngle;
+gps::VarianceShadowMap dynamicMomentMap;
+// city meshes drawn in the current shadow pass, null for all of them
+const std::vector<bool>* shadowMeshMask = nullptr;
+
+// shadow caster culling, meshes that cannot shadow anything the camera sees are skipped
+bool shadowCasterCulling = true;
+std::vector<gps::BoundingBox> cityMeshBounds;
+std::vector<int> cityMeshTriangles;
+int carDrawCount = 0;
+int carTriangleCount = 0;
+std::vector<bool> shadowCasterMask;
+int shadowStatsFrame = 0;
+
+// draws and triangles of the shadow passes in a frame, with and without caster culling
+struct ShadowCasterStats {
+    int drawsBefore;
+    int drawsAfter;
+    long long trianglesBefore;
+    long long trianglesAfter;
+};
+ShadowCasterStats shadowCasterStats;
+
+// street lamps
+struct StreetLamp {
+    glm::vec3 position;
+    glm::vec3 direction;
+    glm::vec3 color;
+    float range;
+    // cosines of the cone angles
+    float innerCutoff;
+    float outerCutoff;
+    glm::mat4 lightSpaceTrMatrix;
+
+    // granted tile, it may be smaller than the requested size while the atlas is full
+    gps::ShadowTile tile;
+    int requestedSize;
+    // the tile has been drawn at least once, and is up to date
+    bool tileReady;
+    bool tileValid;
+    float importance;
+    long long updateFrame;
+};
+
+// layout of one lamp shadow in the std140 StreetLamps block, the lamp itself is a cluster light
+struct StreetLampData {
+    glm::mat4 lightSpaceTrMatrix;
+    glm::vec4 shadowRect;
+};
+
+std::vector<StreetLamp> streetLamps;
+gps::ShadowAtlas lampShadowAtlas;
+GLuint streetLampBuffer;
+bool streetLampsOn = false;
+long long lampFrame = 0;
+gps::BoundingBox lastCarBounds;
+glm::vec3 nightLightColor = glm::vec3(0.12f, 0.12f, 0.2f);
+
+// every night light, the street lamps first, binned into clusters each frame
+std::vector<gps::ClusterLight> nightLights;
+gps::LightClusters lightClusters;
+int clusterStatsFrame = 0;
 
 // rotate camera
 bool cameraRotation = false;
@@ -96,6 +271,134 @@ float spotLight2;
 glm::vec3 spotLightDirection;
 glm::vec3 spotLightPosition;
 
+// occlusion culling
+gps::OcclusionCuller cityOcclusionCuller;
+bool occlusionCulling = false;
+int occlusionStatsFrame = 0;
+
+// potentially visible sets
+const char* cityPvsFile = "models/city/city.pvs";
+gps::PotentiallyVisibleSet cityPvs;
+bool pvsCulling = false;
+int pvsCell = -2;
+std::vector<bool> cityMeshMask;
+
+// depth pre-pass
+bool depthPrepass = false;
+// --shader-bench times the shaded draws of the colour pass with this query, 0 otherwise
+GLuint shadedPassQuery = 0;
+
+// deferred shading, the scene is drawn once into the G-buffer and lit by one fullscreen pass
+enum RENDER_PATH { RENDER_FORWARD, RENDER_DEFERRED };
+RENDER_PATH renderPath = RENDER_FORWARD;
+gps::GBuffer gBuffer;
+
+// shader LOD, forward path only: each city mesh and the car get a cheaper scene shader variant
+// the further they are from the camera
+bool shaderLod = false;
+gps::ShaderLod cityShaderLod;
+gps::ShaderLod carShaderLod;
+// scene shader of each tier in the current colour pass, null to draw everything with one shader
+const std::vector<gps::Shader>* colorLodShaders = nullptr;
+std::vector<gps::Shader> lodShaders;
+std::vector<bool> lodMeshMask;
+int shaderLodStatsFrame = 0;
+
+// GPU time of the passes of renderScene, with --gpu-profile
+gps::GpuProfiler gpuProfiler;
+bool gpuProfiling = false;
+int gpuStatsFrame = 0;
+
+// CPU zones, recorded with --cpu-profile and written at exit or when L is pressed
+const char* cpuTraceFile = "cpu_trace.json";
+
+// last frame's draw calls and uploads per pass, shown over the scene when B is pressed
+gps::TextOverlay statsOverlay;
+gps::Shader textShader;
+bool statsOverlayOn = false;
+
+// --benchmark plays a camera path and records the times and counters of every frame
+gps::CameraPath benchmarkPath;
+gps::BenchmarkRecorder benchmarkRecorder;
+// the built-in path when empty
+std::string benchmarkPathFile;
+std::string benchmarkCsvFile = "benchmark.csv";
+// frame time limits of a passing run, 0 for none
+double benchmarkMaxP95 = 0.0;
+double benchmarkMaxP99 = 0.0;
+// --perf-gate compares the run with a baseline, --write-baseline stores the run as one
+std::string perfBaselineFile;
+std::string writeBaselineFile;
+
+// key and cursor events of a session, written with --record-input and fed back with --replay-input
+gps::InputLog inputLog;
+bool inputReplay = false;
+// frames of the application loop so far, events are logged against the frame that polled them
+int frameIndex = 0;
+// --frames, the loop stops after this many frames when not 0
+int frameLimit = 0;
+// every frame waits for its shader variants instead of drawing with a fallback: replays, captures
+// and headless runs draw the same frames every time
+bool completeFrames = false;
+
+// --capture writes the last frame drawn as a binary PPM
+std::string captureFile;
+
+// F adds the current view as a keyframe of a path for --benchmark-path
+gps::CameraPath recordedPath;
+const char* recordedPathFile = "camera_path.txt";
+double recordedPathStart = 0.0;
+
+// features of the scene shaders for the current settings
+unsigned int getSceneFeatures() {
+    unsigned int features = 0;
+    if (foginit == 1)
+        features |= FEATURE_FOG;
+    if (spotLightInitialize == 1)
+        features |= FEATURE_SPOTLIGHT;
+    if (streetLampsOn)
+        features |= FEATURE_CLUSTERED_LIGHTS;
+    if (shadowsOn) {
+        if (shadowMode == SHADOW_CASCADED || shadowMode == SHADOW_SAMPLE_DISTRIBUTION)
+            features |= FEATURE_CASCADED_SHADOWS;
+        else if (shadowMode == SHADOW_EXPONENTIAL)
+            features |= FEATURE_SOFT_SHADOWS;
+        else
+            features |= FEATURE_CACHED_SHADOWS;
+    }
+    return features;
+}
+
+// features of the scene shader for objects at a shader LOD tier, every tier drops more work
+unsigned int getLodFeatures(unsigned int features, int tier) {
+    if (tier >= 1)
+        features |= FEATURE_NO_SPECULAR;
+    if (tier >= 2)
+        features &= ~(SHADOW_FEATURES | FEATURE_SPOTLIGHT);
+    // the night lights are dropped as well, only the sun and the fog are left
+    if (tier >= 3)
+        features = (features & FEATURE_FOG) | FEATURE_VERTEX_LIGHTING;
+    return features;
+}
+
+// passes drawing the scene, only the colour pass binds materials and lighting uniforms
+enum RENDER_PASS { SHADOW_PASS, DEPTH_PREPASS, COLOR_PASS };
+
+gps::DRAW_MODE getDrawMode(RENDER_PASS pass) {
+    return pass == COLOR_PASS ? gps::DRAW_FULL : gps::DRAW_DEPTH_ONLY;
+}
+
+// passes of renderScene are timed on the GPU and have their submissions counted under the same name
+void beginPass(const char* name) {
+    gpuProfiler.Begin(name);
+    gps::RenderStats::BeginPass(name);
+}
+
+void endPass() {
+    gps::RenderStats::EndPass();
+    gpuProfiler.End();
+}
+
 
 void sceneAnimation() {
     if (startAnimation) {
@@ -142,9 +445,57 @@ void windowResizeCallback(GLFWwindow* window, int width, int height) {
     fprintf(stdout, "Window resized! New width: %d , and height: %d\n", width, height);
 }
 
-void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
+void writeCpuTrace() {
+    if (gps::CpuProfiler::WriteTrace(cpuTraceFile))
+        std::cout << "CPU trace: " << gps::CpuProfiler::getZoneCount() << " zones written to " << cpuTraceFile << std::endl;
+    else
+        std::cerr << "CPU trace: cannot write " << cpuTraceFile << std::endl;
+    long long droppedZones = gps::CpuProfiler::getDroppedZoneCount();
+    if (droppedZones > 0)
+        std::cout << "CPU trace: " << droppedZones << " zones dropped after the buffers filled up" << std::endl;
+}
+
+// at exit, after cleanup stopped the worker threads
+void shutdownCpuProfiler() {
+    if (gps::CpuProfiler::isEnabled()) {
+        writeCpuTrace();
+    }
+    gps::CpuProfiler::Shutdown();
+}
+
+// keyframes are timed from the first one, the file is rewritten after each
+void recordPathKeyframe() {
+    if (recordedPath.getKeyframeCount() == 0)
+        recordedPathStart = glfwGetTime();
+
+    gps::CameraKeyframe keyframe;
+    keyframe.time = (float)(glfwGetTime() - recordedPathStart);
+    keyframe.position = myCamera.getCameraPosition();
+    keyframe.target = myCamera.getCameraTarget();
+    keyframe.carDistance = carDistance;
+    keyframe.lightAngle = lightAngle;
+    recordedPath.addKeyframe(keyframe);
+    if (recordedPath.Save(recordedPathFile))
+        std::cout << "Camera path: keyframe " << recordedPath.getKeyframeCount() << " at " << keyframe.time
+            << " s written to " << recordedPathFile << std::endl;
+}
+
+void handleKey(int key, int scancode, int action, int mode) {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
-        glfwSetWindowShouldClose(window, GL_TRUE);
+        myWindow.setShouldClose(true);
+    }
+
+    // write the CPU trace recorded so far, once per key press
+    if (key == GLFW_KEY_L && action == GLFW_PRESS && gps::CpuProfiler::isEnabled()) {
+        writeCpuTrace();
+    }
+
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        statsOverlayOn = !statsOverlayOn;
+    }
+
+    if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+        recordPathKeyframe();
     }
 
     if (key >= 0 && key < 1024) {
@@ -157,9 +508,20 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
     }
 }
 
+void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
+    // a replayed session only listens to ESC
+    if (inputReplay) {
+        if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+            glfwSetWindowShouldClose(window, GL_TRUE);
+        return;
+    }
+    if (inputLog.isRecording()) {
+        inputLog.addKey(frameIndex, key, scancode, action, mode);
+    }
+    handleKey(key, scancode, action, mode);
+}
+
 void updateView() {
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
 }
 
@@ -168,7 +530,7 @@ double oldYPos;
 const float cameraDefaultRotation = 0.1f;
 
 //bool mouseMoved = false;
-void mouseCallback(GLFWwindow* window, double xPos, double yPos)
+void handleCursor(double xPos, double yPos)
 {
     //mouseMoved = true;
     myCamera.rotate((oldYPos - yPos) * cameraDefaultRotation, (oldXPos - xPos) * cameraDefaultRotation);
@@ -179,6 +541,31 @@ void mouseCallback(GLFWwindow* window, double xPos, double yPos)
     updateView();
 }
 
+void mouseCallback(GLFWwindow* window, double xPos, double yPos)
+{
+    if (inputReplay)
+        return;
+    if (inputLog.isRecording()) {
+        inputLog.addCursor(frameIndex, xPos, yPos);
+    }
+    handleCursor(xPos, yPos);
+}
+
+// the events recorded while this frame polled, in their order, then the window closes after the last frame
+void replayInput() {
+    gps::InputEvent event;
+    while (inputLog.nextEvent(frameIndex, event)) {
+        if (event.type == gps::INPUT_KEY)
+            handleKey(event.key, event.scancode, event.action, event.mods);
+        else
+            handleCursor(event.x, event.y);
+    }
+    if (frameIndex + 1 >= inputLog.getFrameCount()) {
+        std::cout << "Input replay: " << inputLog.getFrameCount() << " frames replayed" << std::endl;
+        myWindow.setShouldClose(true);
+    }
+}
+
 // initialize faces for skybox
 void initFaces()
 {
@@ -205,11 +592,16 @@ bool checkCollision() {
     return cameraX > 80 || cameraX < -30 || cameraY < 0 || cameraZ < -90 || cameraZ > 40;
 }
 
-bool carAnimationBool = false;
-float wheelAngle = 0.0f;
-float carDistance = 0.0f;
+// volume the camera is kept inside by checkCollision, used to bake visibility
+gps::BoundingBox getWalkableVolume() {
+    gps::BoundingBox volume;
+    volume.min = glm::vec3(-30.0f, 0.0f, -90.0f);
+    volume.max = glm::vec3(80.0f, 40.0f, 40.0f);
+    return volume;
+}
 
 void processMovement() {
+    PROFILE_ZONE("processMovement");
     if (pressedKeys[GLFW_KEY_N])
         activateCollisions = true;
 
@@ -256,8 +648,6 @@ void processMovement() {
         myCamera.move(gps::MOVE_UP, cameraSpeed);
         //update view matrix
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -273,16 +663,10 @@ void processMovement() {
 
     if (pressedKeys[GLFW_KEY_Q]) {
         lightAngle -= 1.0f;
-        glm::vec3 lightDirTr = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
-        myBasicShader.useShaderProgram();
-        glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDirTr));
     }
 
     if (pressedKeys[GLFW_KEY_E]) {
         lightAngle += 1.0f;
-        glm::vec3 lightDirTr = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
-        myBasicShader.useShaderProgram();
-        glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDirTr));
     }
 
     // start scene animation
@@ -297,17 +681,12 @@ void processMovement() {
 
     // start fog
     if (pressedKeys[GLFW_KEY_3]) {
-        myBasicShader.useShaderProgram();
         foginit = 1;
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "foginit"), foginit);
     }
 
     // stop fog
     if (pressedKeys[GLFW_KEY_4]) {
-        myBasicShader.useShaderProgram();
         foginit = 0;
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "foginit"), foginit);
-
     }
 
     // increase fog density
@@ -323,16 +702,12 @@ void processMovement() {
 
     // start spotlight
     if (pressedKeys[GLFW_KEY_C]) {
-        myBasicShader.useShaderProgram();
         spotLightInitialize = 1;
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "spotLightInitialize"), spotLightInitialize);
     }
 
     // stop spotlight
     if (pressedKeys[GLFW_KEY_V]) {
-        myBasicShader.useShaderProgram();
         spotLightInitialize = 0;
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "spotLightInitialize"), spotLightInitialize);
     }
 
     if (pressedKeys[GLFW_KEY_7]) {
@@ -359,6 +734,106 @@ void processMovement() {
         carAnimationBool = false;
     }
 
+    // start occlusion culling
+    if (pressedKeys[GLFW_KEY_O]) {
+        occlusionCulling = true;
+    }
+
+    // stop occlusion culling
+    if (pressedKeys[GLFW_KEY_P]) {
+        occlusionCulling = false;
+    }
+
+    // start depth pre-pass
+    if (pressedKeys[GLFW_KEY_G]) {
+        depthPrepass = true;
+    }
+
+    // stop depth pre-pass
+    if (pressedKeys[GLFW_KEY_H]) {
+        depthPrepass = false;
+    }
+
+    // cached city map with a map around the car
+    if (pressedKeys[GLFW_KEY_F1]) {
+        shadowMode = SHADOW_CACHED;
+    }
+
+    // cascaded shadow maps
+    if (pressedKeys[GLFW_KEY_F2]) {
+        shadowMode = SHADOW_CASCADED;
+    }
+
+    // cascades fitted to the visible depth range
+    if (pressedKeys[GLFW_KEY_F3]) {
+        shadowMode = SHADOW_SAMPLE_DISTRIBUTION;
+    }
+
+    // soft exponential variance shadow maps
+    if (pressedKeys[GLFW_KEY_F4]) {
+        shadowMode = SHADOW_EXPONENTIAL;
+    }
+
+    // shadows on
+    if (pressedKeys[GLFW_KEY_F9]) {
+        shadowsOn = true;
+    }
+
+    // shadows off
+    if (pressedKeys[GLFW_KEY_F10]) {
+        shadowsOn = false;
+    }
+
+    // start shadow caster culling
+    if (pressedKeys[GLFW_KEY_Z]) {
+        shadowCasterCulling = true;
+    }
+
+    // stop shadow caster culling
+    if (pressedKeys[GLFW_KEY_X]) {
+        shadowCasterCulling = false;
+    }
+
+    // night, street lamps on
+    if (pressedKeys[GLFW_KEY_F5]) {
+        streetLampsOn = true;
+    }
+
+    // day, street lamps off
+    if (pressedKeys[GLFW_KEY_F6]) {
+        streetLampsOn = false;
+    }
+
+    // forward shading
+    if (pressedKeys[GLFW_KEY_F7]) {
+        renderPath = RENDER_FORWARD;
+    }
+
+    // deferred shading
+    if (pressedKeys[GLFW_KEY_F8]) {
+        renderPath = RENDER_DEFERRED;
+    }
+
+    // start PVS culling
+    if (pressedKeys[GLFW_KEY_J]) {
+        pvsCulling = true;
+    }
+
+    // stop PVS culling
+    if (pressedKeys[GLFW_KEY_K]) {
+        pvsCulling = false;
+    }
+
+    // start shader LOD
+    if (pressedKeys[GLFW_KEY_F11]) {
+        shaderLod = true;
+    }
+
+    // stop shader LOD
+    if (pressedKeys[GLFW_KEY_F12]) {
+        shaderLod = false;
+    }
+
     if (pressedKeys[GLFW_KEY_I]) {
         carAnimationBool = true;
         carDistance-=0.1f;
@@ -369,11 +844,16 @@ void processMovement() {
 
 }
 
-void initOpenGLWindow() {
-    myWindow.Create(1024, 768, "OpenGL Project Core");
+void initOpenGLWindow(bool headless) {
+    if (headless)
+        myWindow.CreateHeadless(1024, 768);
+    else
+        myWindow.Create(1024, 768, "OpenGL Project Core");
 }
 
 void setWindowCallbacks() {
+    if (myWindow.isHeadless())
+        return;
     glfwGetCursorPos(myWindow.getWindow(), &oldXPos, &oldYPos);
     glfwSetInputMode(myWindow.getWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetWindowSizeCallback(myWindow.getWindow(), windowResizeCallback);
@@ -394,6 +874,7 @@ void initOpenGLState() {
 }
 
 void initModels() {
+    PROFILE_ZONE("initModels");
     city.LoadModel("models/city/city.obj");
     lightCube.LoadModel("models/cube/cube.obj");
     frontWheels.LoadModel("models/frontWheels/frontWheels.obj");
@@ -401,60 +882,143 @@ void initModels() {
     carBody.LoadModel("models/carBody/carBody.obj");
 }
 
+// lamp shadows and cluster buffers, for the scene and composite shaders with CLUSTERED_LIGHTS
+void initClusteredLightUniforms(gps::Shader shader) {
+    GLuint streetLampsIndex = glGetUniformBlockIndex(shader.shaderProgram, "StreetLamps");
+    if (streetLampsIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(shader.shaderProgram, streetLampsIndex, 0);
+    }
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "lampShadowAtlas"), 8);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterLightData"), 9);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterGrid"), 10);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterLightIndices"), 11);
+}
+
+// uniforms of basic.frag that never change, set once for every variant
+void initSceneShader(gps::Shader shader) {
+    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(sceneProjection));
+
+    glUniform1f(glGetUniformLocation(shader.shaderProgram, "spotlight1"), spotLight1);
+    glUniform1f(glGetUniformLocation(shader.shaderProgram, "spotlight2"), spotLight2);
+    glUniform3fv(glGetUniformLocation(shader.shaderProgram, "spotLightDirection"), 1, glm::value_ptr(spotLightDirection));
+    glUniform3fv(glGetUniformLocation(shader.shaderProgram, "spotLightPosition"), 1, glm::value_ptr(spotLightPosition));
+
+    // every sampler gets its own unit, the array one cannot share unit 0 with 2D samplers
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "shadowMap"), 3);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "dynamicShadowMap"), 4);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "cascadeShadowMap"), 5);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "shadowMoments"), 6);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "dynamicShadowMoments"), 7);
+    initClusteredLightUniforms(shader);
+}
+
+void initDeferredShader(gps::Shader shader) {
+    glUniform3fv(glGetUniformLocation(shader.shaderProgram, "spotLightPosition"), 1, glm::value_ptr(spotLightPosition));
+    initClusteredLightUniforms(shader);
+}
+
+// submits every program at once, they compile in the background while the models load
 void initShaders() {
-    myBasicShader.loadShader(
+    PROFILE_ZONE("initShaders");
+    basicShaders.Create(
+        "shaders/basic.vert",
+        "shaders/basic.frag",
+        shaderFeatureNames, ~0u, {}, initSceneShader);
+    gBufferShaders.Create(
         "shaders/basic.vert",
-        "shaders/basic.frag");
-    myBasicShader.useShaderProgram();
-    lightShader.loadShader(
+        "shaders/basic.frag",
+        shaderFeatureNames, SHADOW_FEATURES, { "GBUFFER_PASS" }, initSceneShader);
+    deferredShaders.Create(
+        "shaders/fullscreen.vert",
+        "shaders/deferredLighting.frag",
+        shaderFeatureNames, LIGHTING_FEATURES, {}, initDeferredShader);
+    // the variants of the starting settings, and the plain variants standing in for any other
+    unsigned int features = getSceneFeatures();
+    for (gps::ShaderPermutations* permutations : { &basicShaders, &gBufferShaders, &deferredShaders }) {
+        permutations->Request(0);
+    }
+    if (renderPath == RENDER_DEFERRED) {
+        gBufferShaders.Request(features);
+        deferredShaders.Request(features);
+    }
+    else {
+        basicShaders.Request(features);
+    }
+
+    lightShader.beginLoading(
         "shaders/lightCube.vert",
         "shaders/lightCube.frag");
-    lightShader.useShaderProgram();
-    depthMapShader.loadShader(
+    depthMapShader.beginLoading(
         "shaders/depthMap.vert",
         "shaders/depthMap.frag");
-    depthMapShader.useShaderProgram();
+    depthPrepassShader.beginLoading(
+        "shaders/depthPrepass.vert",
+        "shaders/depthMap.frag");
+    depthReduceShader.beginLoading(
+        "shaders/fullscreen.vert",
+        "shaders/depthReduce.frag");
+    momentShader.beginLoading(
+        "shaders/depthMap.vert",
+        "shaders/shadowMoments.frag");
+    blurShader.beginLoading(
+        "shaders/fullscreen.vert",
+        "shaders/blur.frag");
+    skyboxShader.beginLoading(
+        "shaders/skyboxShader.vert",
+        "shaders/skyboxShader.frag");
+    textShader.beginLoading(
+        "shaders/text.vert",
+        "shaders/text.frag");
 }
 
-void initUniforms() {
-    myBasicShader.useShaderProgram();
+// the time from startup until every requested scene variant was ready, with where the programs
+// came from, so cold and warm runs of the program binary cache compare over all programs
+void reportShaderStartup() {
+    if (shaderStartupReported)
+        return;
+    for (gps::ShaderPermutations* permutations : { &basicShaders, &gBufferShaders, &deferredShaders }) {
+        if (!permutations->isComplete())
+            return;
+    }
+    shaderStartupReported = true;
+    std::cout << "Shader startup: every requested variant ready after "
+        << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shaderStartupStart).count() << " ms, "
+        << gps::Shader::getCachedProgramCount() << " programs from the binary cache, "
+        << gps::Shader::getCompiledProgramCount() << " compiled" << std::endl;
+}
+
+// waits for the programs used from the first frame on, the scene variants are picked up when ready
+void finishShaders() {
+    PROFILE_ZONE("finishShaders");
+    for (gps::Shader* shader : { &lightShader, &depthMapShader, &depthPrepassShader, &depthReduceShader,
+        &momentShader, &blurShader, &skyboxShader, &textShader }) {
+        shader->finishLoading();
+    }
+}
 
+// the scene shader uniforms are uploaded by initSceneShader and every frame by renderScene
+void initUniforms() {
     // create model matrix
     model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-    modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
     // get view matrix for current camera
     view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-    // send view matrix to shader
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     // compute normal matrix
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
-    //glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
 
     // create projection matrix
     projection = glm::perspective(glm::radians(45.0f),
         (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
         0.1f, 1000.0f);
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    // send projection matrix to shader
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    sceneProjection = projection;
 
     //set the light direction (direction towards the light)
     lightDir = glm::vec3(-49.0f, 62.5f, -43.5f);
     lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-    // send light dir to shader
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(lightRotation)) * lightDir));
 
     //set light color
     lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-    lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-    // send light color to shader
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
 
     // spotlight
     spotLight1 = glm::cos(glm::radians(45.5f));
@@ -463,20 +1027,17 @@ void initUniforms() {
     spotLightDirection = glm::vec3(49.25f, 2.6148f, -16.328f);
     spotLightPosition = glm::vec3(49.25f, 4.6148f, -16.328f);
 
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "spotlight1"), spotLight1);
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "spotlight2"), spotLight2);
-
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLightDirection"), 1, glm::value_ptr(spotLightDirection));
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLightPosition"), 1, glm::value_ptr(spotLightPosition));
-
     lightShader.useShaderProgram();
     glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+
+    depthPrepassShader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(depthPrepassShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
 }
 
 void initSkyBoxShader()
 {
+    PROFILE_ZONE("initSkyBoxShader");
     mySkyBox.Load(faces);
-    skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
     skyboxShader.useShaderProgram();
     view = myCamera.getViewMatrix();
     glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "view"), 1, GL_FALSE,
@@ -488,192 +1049,1041 @@ void initSkyBoxShader()
 }
 
 void initFBO() {
-    //TODO - Create the FBO, the depth texture and attach the depth texture to the FBO
-
-     //generate FBO ID
-    glGenFramebuffers(1, &shadowMapFBO);
-
-    //create depth texture for FBO
-    glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-        SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-
-    //attach texture to FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-void renderCity(gps::Shader shader, bool depth) {
+    depthRange.Create(myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height, myWindow.getDepthFormat());
+    gBuffer.Create(myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+}
+
+glm::mat4 getCityModel() {
+    return glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.05f, 6.0f));
+}
+
+void initOcclusionCulling() {
+    cityOcclusionCuller.Build(city, getCityModel());
+}
+
+int countTriangles(gps::Model3D& model) {
+    int triangles = 0;
+    for (gps::Mesh& mesh : model.getMeshes()) {
+        triangles += (int)mesh.indices.size() / 3;
+    }
+    return triangles;
+}
+
+// world space bounds and sizes of the shadow casters, for culling and statistics
+void initShadowCasters() {
+    cityMeshBounds.clear();
+    cityMeshTriangles.clear();
+    for (gps::Mesh& mesh : city.getMeshes()) {
+        cityMeshBounds.push_back(gps::transformBoundingBox(mesh.getBounds(), getCityModel()));
+        cityMeshTriangles.push_back((int)mesh.indices.size() / 3);
+    }
+
+    carDrawCount = (int)(carBody.getMeshes().size() + frontWheels.getMeshes().size() + backWheels.getMeshes().size());
+    carTriangleCount = countTriangles(carBody) + countTriangles(frontWheels) + countTriangles(backWheels);
+}
+
+void initShaderLod() {
+    cityShaderLod.Create(SHADER_LOD_DISTANCES, SHADER_LOD_HYSTERESIS);
+    carShaderLod.Create(SHADER_LOD_DISTANCES, SHADER_LOD_HYSTERESIS);
+}
+
+// two rows of lamps along the street the car drives on, leaning over the road
+void initStreetLamps() {
+    const float roadCenter = 68.0f;
+    for (int side = 0; side < 2; side++) {
+        float x = side == 0 ? roadCenter - 4.5f : roadCenter + 4.5f;
+        for (int i = 0; i < 12; i++) {
+            StreetLamp lamp = {};
+            lamp.position = glm::vec3(x, 6.0f, -16.0f - 8.0f * i + side * 4.0f);
+            lamp.direction = glm::normalize(glm::vec3((roadCenter - x) * 0.1f, -1.0f, 0.0f));
+            lamp.color = glm::vec3(1.0f, 0.78f, 0.45f);
+            lamp.range = 14.0f;
+            lamp.innerCutoff = glm::cos(glm::radians(35.0f));
+            lamp.outerCutoff = glm::cos(glm::radians(55.0f));
+
+            glm::mat4 lampView = glm::lookAt(lamp.position, lamp.position + lamp.direction, glm::vec3(0.0f, 0.0f, 1.0f));
+            glm::mat4 lampProjection = glm::perspective(glm::radians(110.0f), 1.0f, 0.1f, lamp.range);
+            lamp.lightSpaceTrMatrix = lampProjection * lampView;
+            lamp.updateFrame = -1;
+            streetLamps.push_back(lamp);
+        }
+    }
+
+    lampShadowAtlas.Create(LAMP_ATLAS_SIZE, LAMP_MIN_TILE_SIZE);
+
+    glGenBuffers(1, &streetLampBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, streetLampBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, MAX_STREET_LAMPS * sizeof(StreetLampData), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, streetLampBuffer);
+}
+
+// the street lamps, then a grid of small unshadowed lights over the whole city
+void initNightLights() {
+    for (size_t i = 0; i < streetLamps.size(); i++) {
+        StreetLamp& lamp = streetLamps[i];
+        gps::ClusterLight light;
+        light.position = lamp.position;
+        light.range = lamp.range;
+        light.color = lamp.color;
+        light.direction = lamp.direction;
+        light.innerCutoff = lamp.innerCutoff;
+        light.outerCutoff = lamp.outerCutoff;
+        light.shadowIndex = (int)i;
+        nightLights.push_back(light);
+    }
+
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> hue(0.0f, 1.0f);
+    gps::BoundingBox volume = getWalkableVolume();
+    for (float x = volume.min.x + 2.0f; x < volume.max.x; x += 6.0f) {
+        for (float z = volume.min.z + 2.0f; z < volume.max.z; z += 6.0f) {
+            gps::ClusterLight light;
+            light.position = glm::vec3(x, 3.0f, z);
+            light.range = 8.0f;
+            light.color = glm::mix(glm::vec3(1.0f, 0.6f, 0.3f), glm::vec3(0.4f, 0.6f, 1.0f), hue(random)) * 0.6f;
+            light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+            light.innerCutoff = -1.0f;
+            light.outerCutoff = -1.0f;
+            light.shadowIndex = -1;
+            nightLights.push_back(light);
+        }
+    }
+
+    lightClusters.Create(CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES, sceneProjection);
+}
+
+void initPvs() {
+    PROFILE_ZONE("initPvs");
+    cityPvs.Load(cityPvsFile, (int)city.getMeshes().size());
+}
+
+void bakePvs() {
+    PROFILE_ZONE("bakePvs");
+    // 10 unit cells, 16 points per cell with 512 rays each
+    cityPvs.Bake(city, getCityModel(), getWalkableVolume(), 10.0f, 16, 512);
+    if (cityPvs.Save(cityPvsFile)) {
+        std::cout << "PVS written to " << cityPvsFile << std::endl;
+    }
+}
+
+// returns the visible mesh flags for the camera cell, null when PVS culling does not apply
+const std::vector<bool>* updatePvsMask() {
+    if (!pvsCulling || !cityPvs.isLoaded())
+        return nullptr;
+
+    int cell = cityPvs.findCell(myCamera.getCameraPosition());
+    if (cell < 0)
+        return nullptr;
+
+    // the mask only changes when the camera crosses into another cell
+    if (cell != pvsCell) {
+        cityPvs.getVisibleMeshes(cell, cityMeshMask);
+        pvsCell = cell;
+    }
+    return &cityMeshMask;
+}
+
+// counts the calls of one statistics printer, true on every STATS_REPORT_FRAMES-th
+bool isStatsReportDue(int& statsFrame) {
+    if (++statsFrame < STATS_REPORT_FRAMES)
+        return false;
+    statsFrame = 0;
+    return true;
+}
+
+void printOcclusionStats() {
+    if (!isStatsReportDue(occlusionStatsFrame))
+        return;
+
+    gps::OcclusionStats stats = cityOcclusionCuller.getStats();
+    std::cout << "Occlusion culling: " << stats.queriesIssued << " queries, "
+        << stats.conditionalDraws << " conditional draws, "
+        << stats.savedDraws << " saved draws, latency "
+        << stats.averageLatencyFrames << " frames (" << stats.averageLatencyMs << " ms)" << std::endl;
+}
+
+// meshes the culler found outside the frustum or the GPU skipped after last frame's queries,
+// meshes cleared in the mask are counted by renderCity
+void countOcclusionCulled(const std::vector<bool>* meshMask) {
+    gps::OcclusionStats stats = cityOcclusionCuller.getStats();
+    int candidates = meshMask ? (int)std::count(meshMask->begin(), meshMask->end(), true) : (int)city.getMeshes().size();
+    gps::RenderStats::countCulled(candidates - stats.meshesDrawn + stats.savedDraws);
+}
+
+// the city meshes of each shader LOD tier with the variant of the tier, model and normal matrix
+// are the same for all of them
+void renderCityLod(const std::vector<bool>* meshMask) {
+    PROFILE_ZONE("renderCityLod");
+    const std::vector<gps::Shader>& tierShaders = *colorLodShaders;
+    for (size_t tier = 1; tier < tierShaders.size(); tier++) {
+        gps::Shader tierShader = tierShaders[tier];
+        tierShader.useShaderProgram();
+        glUniformMatrix4fv(glGetUniformLocation(tierShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniformMatrix3fv(glGetUniformLocation(tierShader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    }
+
+    if (occlusionCulling) {
+        cityOcclusionCuller.Draw(city, tierShaders[0], lightShader, view, sceneProjection, myCamera.getCameraPosition(), meshMask,
+            &tierShaders, &cityShaderLod.getTiers());
+        countOcclusionCulled(meshMask);
+        printOcclusionStats();
+        return;
+    }
+    // one batch per tier, so the program changes at most once per tier
+    for (size_t tier = 0; tier < tierShaders.size(); tier++) {
+        if (cityShaderLod.countObjects((int)tier) == 0)
+            continue;
+        cityShaderLod.getTierMask((int)tier, lodMeshMask, meshMask);
+        gps::Shader tierShader = tierShaders[tier];
+        tierShader.useShaderProgram();
+        city.Draw(tierShader, lodMeshMask);
+    }
+}
+
+void renderCity(gps::Shader shader, RENDER_PASS pass) {
+    PROFILE_ZONE("renderCity");
     // select active shader program
     shader.useShaderProgram();
-    model = glm::mat4(1.0f);
-    model = glm::scale(model, glm::vec3(2.0f));
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.05f, 6.0f));
+    model = getCityModel();
 
     //send scene model matrix data to shader
     glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    if (depth) {
+    if (pass == COLOR_PASS) {
         //send teapot normal matrix data to shader
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    }
+    // draw city, shadow casters outside the camera's PVS still have to be drawn
+    const std::vector<bool>* meshMask = pass == SHADOW_PASS ? shadowMeshMask : updatePvsMask();
+    if (meshMask) {
+        gps::RenderStats::countCulled((int)std::count(meshMask->begin(), meshMask->end(), false));
+    }
+    if (pass == COLOR_PASS && colorLodShaders) {
+        renderCityLod(meshMask);
+    }
+    else if (pass == COLOR_PASS && occlusionCulling) {
+        cityOcclusionCuller.Draw(city, shader, lightShader, view, sceneProjection, myCamera.getCameraPosition(), meshMask);
+        countOcclusionCulled(meshMask);
+        printOcclusionStats();
+    }
+    else if (meshMask) {
+        city.Draw(shader, *meshMask, getDrawMode(pass));
+    }
+    else {
+        city.Draw(shader, getDrawMode(pass));
     }
-    // draw city
-    city.Draw(shader);
 }
 
-void renderFrontWheels(gps::Shader shader, bool depth) {
-    
-    // select active shader program
-    shader.useShaderProgram();
-    model = glm::mat4(1.0f);
-    //model = glm::scale(model, glm::vec3(2.0f));
-    //model = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.05f, 6.0f));
+glm::mat4 getFrontWheelsModel() {
+    glm::mat4 wheelsModel = glm::mat4(1.0f);
     if (carAnimationBool)
     {
+        wheelsModel = glm::translate(wheelsModel, glm::vec3(68.085f, 0.072701f, (-24.178f - carDistance)));
+        wheelsModel = glm::rotate(wheelsModel, glm::radians(wheelAngle), glm::vec3(1, 0, 0));
+        wheelsModel = glm::translate(wheelsModel, glm::vec3(-68.085f, -0.072701f, 24.178f));
+    }
+    return wheelsModel;
+}
 
-        model = glm::translate(model, glm::vec3(68.085f, 0.072701f, (-24.178f - carDistance)));
-
-        model = glm::rotate(model, glm::radians(wheelAngle), glm::vec3(1, 0, 0));
-        model = glm::translate(model, glm::vec3(-68.085f, -0.072701f, 24.178f));
-
+glm::mat4 getBackWheelsModel() {
+    glm::mat4 wheelsModel = glm::mat4(1.0f);
+    if (carAnimationBool)
+    {
+        wheelsModel = glm::translate(wheelsModel, glm::vec3(68.085f, 0.072704f, (-22.22f - carDistance)));
+        wheelsModel = glm::rotate(wheelsModel, glm::radians(wheelAngle), glm::vec3(1, 0, 0));
+        wheelsModel = glm::translate(wheelsModel, glm::vec3(-68.085f, -0.072704f, 22.22f));
+    }
+    return wheelsModel;
+}
 
+glm::mat4 getCarBodyModel() {
+    glm::mat4 bodyModel = glm::mat4(1.0f);
+    if (carAnimationBool)
+    {
+        //translate body forward
+        bodyModel = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, (-carDistance)));
     }
-     
+    return bodyModel;
+}
+
+void renderFrontWheels(gps::Shader shader, RENDER_PASS pass) {
+    PROFILE_ZONE("renderFrontWheels");
+    
+    // select active shader program
+    shader.useShaderProgram();
+    model = getFrontWheelsModel();
 
     //send scene model matrix data to shader
     glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    if (depth) {
+    if (pass == COLOR_PASS) {
         //send normal matrix data to shader
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
     }
     // draw frontWheels
-    frontWheels.Draw(shader);
+    frontWheels.Draw(shader, getDrawMode(pass));
 }
 
-void renderbackWheels(gps::Shader shader, bool depth) {
+void renderbackWheels(gps::Shader shader, RENDER_PASS pass) {
+    PROFILE_ZONE("renderbackWheels");
     // select active shader program
     shader.useShaderProgram();
-    model = glm::mat4(1.0f);
-    //model = glm::scale(model, glm::vec3(2.0f));
-    //model = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.05f, 6.0f));
-  
-    if (carAnimationBool)
-    {
-        model = glm::translate(model, glm::vec3(68.085f, 0.072704f, (-22.22f - carDistance)));
-
-        model = glm::rotate(model, glm::radians(wheelAngle), glm::vec3(1, 0, 0));
-        model = glm::translate(model, glm::vec3(-68.085f, -0.072704f, 22.22f));
-
-
-    }
+    model = getBackWheelsModel();
 
     //send scene model matrix data to shader
     glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    if (depth) {
+    if (pass == COLOR_PASS) {
         //send normal matrix data to shader
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
     }
     // draw backWheels
-    backWheels.Draw(shader);
+    backWheels.Draw(shader, getDrawMode(pass));
 }
 
-void rendercarBody(gps::Shader shader, bool depth) {
+void rendercarBody(gps::Shader shader, RENDER_PASS pass) {
+    PROFILE_ZONE("rendercarBody");
     // select active shader program
     shader.useShaderProgram();
-    //model = glm::scale(model, glm::vec3(2.0f));
-    //model = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.05f, 6.0f));
-    model = glm::mat4(1.0f);
-    if(carAnimationBool)
-    {
-        //translate body forward
-        model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, (-carDistance)));
-    }
+    model = getCarBodyModel();
 
     //send scene model matrix data to shader
     glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    if (depth) {
+    if (pass == COLOR_PASS) {
         //send normal matrix data to shader
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
     }
     // draw carBody
-    carBody.Draw(shader);
+    carBody.Draw(shader, getDrawMode(pass));
+}
+
+// lays down the depth of the scene so the expensive colour pass shades every pixel once
+void renderDepthPrepass() {
+    PROFILE_ZONE("renderDepthPrepass");
+    depthPrepassShader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(depthPrepassShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    renderCity(depthPrepassShader, DEPTH_PREPASS);
+    rendercarBody(depthPrepassShader, DEPTH_PREPASS);
+    renderFrontWheels(depthPrepassShader, DEPTH_PREPASS);
+    renderbackWheels(depthPrepassShader, DEPTH_PREPASS);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    // only the closest surface passes, and the depth buffer is already final
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+}
+
+// direction towards the sun, rotated by lightAngle
+glm::vec3 getLightDirection() {
+    return glm::inverseTranspose(glm::mat3(lightRotation)) * lightDir;
 }
 
 glm::mat4 computeLightSpaceTrMatrix() {
     //TODO - Return the light-space transformation matrix
-    glm::mat4 lightView = glm::lookAt(glm::inverseTranspose(glm::mat3(lightRotation)) * lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 lightView = glm::lookAt(getLightDirection(), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
     const GLfloat near_plane = 0.1f, far_plane = 200.0f;
     glm::mat4 lightProjection = glm::ortho(-100.0f, 100.0f, -100.0f, 100.0f, near_plane, far_plane);
     glm::mat4 lightSpaceTrMatrix = lightProjection * lightView;
     return lightSpaceTrMatrix;
 }
 
+gps::BoundingBox getCarBounds() {
+    gps::BoundingBox bounds = gps::transformBoundingBox(carBody.getBounds(), getCarBodyModel());
+    gps::BoundingBox front = gps::transformBoundingBox(frontWheels.getBounds(), getFrontWheelsModel());
+    gps::BoundingBox back = gps::transformBoundingBox(backWheels.getBounds(), getBackWheelsModel());
+    bounds.min = glm::min(bounds.min, glm::min(front.min, back.min));
+    bounds.max = glm::max(bounds.max, glm::max(front.max, back.max));
+    return bounds;
+}
 
-void renderScene() {
+// light space of the dynamic shadow map, fitted around the car
+glm::mat4 computeDynamicLightSpaceTrMatrix() {
+    gps::BoundingBox carBounds = getCarBounds();
+    glm::vec3 center = (carBounds.min + carBounds.max) * 0.5f;
+    float radius = glm::length(carBounds.max - carBounds.min) * 0.5f + 0.5f;
+
+    // far enough past the car to reach the ground and walls it shades
+    const float shadowReach = 30.0f;
+    glm::vec3 lightDirection = glm::normalize(getLightDirection());
+    glm::mat4 lightView = glm::lookAt(center + lightDirection * (radius + 1.0f), center, glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 lightProjection = glm::ortho(-radius, radius, -radius, radius, 0.1f, 2.0f * radius + 1.0f + shadowReach);
+    return lightProjection * lightView;
+}
 
+// measures the depth range the main pass left behind, the result is read back a few frames later
+// the deferred path has its depth in a texture already, the window's is copied
+void measureDepthRange() {
+    PROFILE_ZONE("measureDepthRange");
+    GLuint depthTexture = renderPath == RENDER_DEFERRED ? gBuffer.getDepthTexture() : depthRange.CopyDepth();
+    depthRange.Reduce(depthReduceShader, depthTexture, view, sceneProjection, depthPartitions);
+    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+}
 
-    sceneAnimation();
+void updateCascades() {
+    //planes and field of view of the scene projection, see LightClusters::Create
+    float projectionNear = sceneProjection[3][2] / (sceneProjection[2][2] - 1.0f);
+    float fovy = 2.0f * std::atan(1.0f / sceneProjection[1][1]);
+    float aspect = sceneProjection[1][1] / sceneProjection[0][0];
+    float nearDepth = projectionNear;
+    float farDepth = SHADOW_DISTANCE;
+
+    float minDepth, maxDepth;
+    if (shadowMode == SHADOW_SAMPLE_DISTRIBUTION && depthRange.getDepthRange(minDepth, maxDepth)) {
+        // padded, the range is a few frames old when it arrives
+        nearDepth = std::max(nearDepth, minDepth * 0.9f);
+        farDepth = std::min(farDepth, maxDepth * 1.1f);
+        if (farDepth <= nearDepth) {
+            nearDepth = projectionNear;
+            farDepth = SHADOW_DISTANCE;
+        }
+    }
+
+    // the measured bounds only hold for the splits they were binned with, the next reduction bins
+    // with the splits of the latest range
+    gps::DepthReduction::Partitions measured;
+    if (shadowMode == SHADOW_SAMPLE_DISTRIBUTION && depthRange.getPartitions(measured) &&
+        measured.count == cascadedShadowMap.getCascadeCount() && measured.splits[0] > nearDepth) {
+        cascadedShadowMap.Update(view, fovy, aspect, nearDepth, measured.splits, getLightDirection(),
+            measured.lightView, measured.bounds);
+    }
+    else {
+        cascadedShadowMap.Update(view, fovy, aspect, nearDepth, farDepth, getLightDirection(), 0.75f);
+    }
+    depthPartitions.count = cascadedShadowMap.getCascadeCount();
+    cascadedShadowMap.ComputeSplits(nearDepth, farDepth, 0.75f, depthPartitions.splits);
+    depthPartitions.lightView = cascadedShadowMap.getLightView();
+}
+
+// culls the city meshes against the caster volume into shadowCasterMask, counting what is kept
+void cullShadowCasters(gps::ShadowCasterVolume& casterVolume) {
+    shadowCasterMask.resize(cityMeshBounds.size());
+    for (size_t i = 0; i < cityMeshBounds.size(); i++) {
+        shadowCasterMask[i] = casterVolume.intersects(cityMeshBounds[i]);
+        shadowCasterStats.drawsBefore++;
+        shadowCasterStats.trianglesBefore += cityMeshTriangles[i];
+        if (shadowCasterMask[i]) {
+            shadowCasterStats.drawsAfter++;
+            shadowCasterStats.trianglesAfter += cityMeshTriangles[i];
+        }
+    }
+}
+
+// counts casters drawn without culling
+void countShadowCasters(int draws, long long triangles) {
+    shadowCasterStats.drawsBefore += draws;
+    shadowCasterStats.drawsAfter += draws;
+    shadowCasterStats.trianglesBefore += triangles;
+    shadowCasterStats.trianglesAfter += triangles;
+}
+
+void countCityShadowCasters() {
+    long long triangles = 0;
+    for (int meshTriangles : cityMeshTriangles) {
+        triangles += meshTriangles;
+    }
+    countShadowCasters((int)cityMeshTriangles.size(), triangles);
+}
+
+// draws the car into the current shadow map, unless it is culled
+void renderCarShadow(gps::Shader shader, bool visible) {
+    PROFILE_ZONE("renderCarShadow");
+    shadowCasterStats.drawsBefore += carDrawCount;
+    shadowCasterStats.trianglesBefore += carTriangleCount;
+    if (!visible) {
+        gps::RenderStats::countCulled(carDrawCount);
+        return;
+    }
+
+    shadowCasterStats.drawsAfter += carDrawCount;
+    shadowCasterStats.trianglesAfter += carTriangleCount;
+    rendercarBody(shader, SHADOW_PASS);
+    renderFrontWheels(shader, SHADOW_PASS);
+    renderbackWheels(shader, SHADOW_PASS);
+}
+
+void printShadowCasterStats() {
+    if (!isStatsReportDue(shadowStatsFrame))
+        return;
+
+    std::cout << "Shadow casters: " << shadowCasterStats.drawsAfter << "/" << shadowCasterStats.drawsBefore << " draws, "
+        << shadowCasterStats.trianglesAfter << "/" << shadowCasterStats.trianglesBefore << " triangles" << std::endl;
+}
+
+void renderCascades(GLint lightSpaceTrMatrixLoc) {
+    PROFILE_ZONE("renderCascades");
+    // slope scaled offset, the texel size changes from one cascade to the next
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+
+    gps::BoundingBox carBounds = getCarBounds();
+    for (int i = 0; i < cascadedShadowMap.getCascadeCount(); i++) {
+        bool carVisible = true;
+        if (shadowCasterCulling) {
+            // only casters between the light and the slice of the camera frustum can shadow it
+            glm::vec3 sliceCorners[8];
+            cascadedShadowMap.getSliceCorners(i, sliceCorners);
+            gps::ShadowCasterVolume casterVolume;
+            casterVolume.build(cascadedShadowMap.getLightView(), sliceCorners, 8);
+            cullShadowCasters(casterVolume);
+            shadowMeshMask = &shadowCasterMask;
+            carVisible = casterVolume.intersects(carBounds);
+        }
+        else {
+            countCityShadowCasters();
+        }
 
+        depthMapShader.useShaderProgram();
+        glUniformMatrix4fv(lightSpaceTrMatrixLoc, 1, GL_FALSE, glm::value_ptr(cascadedShadowMap.getLightSpaceTrMatrix(i)));
+        cascadedShadowMap.Begin(i);
+        renderCity(depthMapShader, SHADOW_PASS);
+        renderCarShadow(depthMapShader, carVisible);
+        cascadedShadowMap.End();
+    }
+
+    shadowMeshMask = nullptr;
+    glDisable(GL_POLYGON_OFFSET_FILL);
+}
+
+// the car shadow only matters if the car is between the sun and something the camera sees
+bool carShadowVisible() {
+    if (!shadowCasterCulling)
+        return true;
+
+    glm::mat4 inverseViewProjection = glm::inverse(sceneProjection * view);
+    glm::vec3 frustumCorners[8];
+    for (int i = 0; i < 8; i++) {
+        glm::vec4 corner = inverseViewProjection * glm::vec4((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f, 1.0f);
+        frustumCorners[i] = glm::vec3(corner) / corner.w;
+    }
+
+    glm::vec3 lightDirection = glm::normalize(getLightDirection());
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -lightDirection, glm::vec3(0.0f, 1.0f, 0.0f));
+    gps::ShadowCasterVolume casterVolume;
+    casterVolume.build(lightView, frustumCorners, 8);
+    return casterVolume.intersects(getCarBounds());
+}
+
+// same split as the cached maps, with the moments blurred and mipmapped after drawing
+void renderMomentMaps() {
+    PROFILE_ZONE("renderMomentMaps");
+    momentShader.useShaderProgram();
+    GLint lightSpaceTrMatrixLoc = glGetUniformLocation(momentShader.shaderProgram, "lightSpaceTrMatrix");
+
+    if (!staticMomentValid || staticMomentLightAngle != lightAngle) {
+        glUniformMatrix4fv(lightSpaceTrMatrixLoc, 1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
+        staticMomentMap.Begin();
+        renderCity(momentShader, SHADOW_PASS);
+        staticMomentMap.End();
+        staticMomentMap.Filter(blurShader);
+        countCityShadowCasters();
+
+        staticMomentValid = true;
+        staticMomentLightAngle = lightAngle;
+    }
+
+    momentShader.useShaderProgram();
+    glUniformMatrix4fv(lightSpaceTrMatrixLoc, 1, GL_FALSE, glm::value_ptr(computeDynamicLightSpaceTrMatrix()));
+    dynamicMomentMap.Begin();
+    renderCarShadow(momentShader, carShadowVisible());
+    dynamicMomentMap.End();
+    dynamicMomentMap.Filter(blurShader);
+}
+
+// only the maps of the active shadow mode are kept, switching modes frees the others
+void allocateShadowMaps() {
+    if (shadowMode == SHADOW_CACHED) {
+        if (!staticShadowMap.getTexture()) {
+            staticShadowMap.Create(SHADOW_WIDTH, SHADOW_HEIGHT);
+            dynamicShadowMap.Create(DYNAMIC_SHADOW_SIZE, DYNAMIC_SHADOW_SIZE);
+            staticShadowValid = false;
+        }
+    }
+    else {
+        staticShadowMap.Delete();
+        dynamicShadowMap.Delete();
+    }
+
+    if (shadowMode == SHADOW_CASCADED || shadowMode == SHADOW_SAMPLE_DISTRIBUTION) {
+        if (!cascadedShadowMap.getTexture())
+            cascadedShadowMap.Create(CASCADE_SIZE, CASCADE_COUNT);
+    }
+    else {
+        cascadedShadowMap.Delete();
+    }
+
+    if (shadowMode == SHADOW_EXPONENTIAL) {
+        if (!staticMomentMap.getTexture()) {
+            staticMomentMap.Create(MOMENT_SHADOW_SIZE);
+            dynamicMomentMap.Create(DYNAMIC_MOMENT_SHADOW_SIZE);
+            staticMomentValid = false;
+        }
+    }
+    else {
+        staticMomentMap.Delete();
+        dynamicMomentMap.Delete();
+    }
+}
+
+void renderShadowMaps() {
+    PROFILE_ZONE("renderShadowMaps");
+    allocateShadowMaps();
+    shadowCasterStats = {};
     depthMapShader.useShaderProgram();
+    GLint lightSpaceTrMatrixLoc = glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix");
 
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    //render scene = draw objects
-    renderCity(depthMapShader, false);
+    if (shadowMode == SHADOW_EXPONENTIAL) {
+        renderMomentMaps();
+        printShadowCasterStats();
+        return;
+    }
+    if (shadowMode != SHADOW_CACHED) {
+        updateCascades();
+        renderCascades(lightSpaceTrMatrixLoc);
+        printShadowCasterStats();
+        return;
+    }
 
+    // the city never moves, so its map is reused until the sun turns
+    // it covers the whole city and does not depend on the camera, so it is never culled
+    if (!staticShadowValid || staticShadowLightAngle != lightAngle) {
+        glUniformMatrix4fv(lightSpaceTrMatrixLoc, 1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
+        staticShadowMap.Begin();
+        renderCity(depthMapShader, SHADOW_PASS);
+        staticShadowMap.End();
+        countCityShadowCasters();
+
+        staticShadowValid = true;
+        staticShadowLightAngle = lightAngle;
+    }
 
+    glUniformMatrix4fv(lightSpaceTrMatrixLoc, 1, GL_FALSE, glm::value_ptr(computeDynamicLightSpaceTrMatrix()));
+    dynamicShadowMap.Begin();
+    renderCarShadow(depthMapShader, carShadowVisible());
+    dynamicShadowMap.End();
+    printShadowCasterStats();
+}
+
+gps::BoundingBox getLampReach(StreetLamp& lamp) {
+    gps::BoundingBox reach;
+    reach.min = lamp.position - glm::vec3(lamp.range);
+    reach.max = lamp.position + glm::vec3(lamp.range);
+    return reach;
+}
+
+bool boxesOverlap(gps::BoundingBox a, gps::BoundingBox b) {
+    return a.min.x <= b.max.x && b.min.x <= a.max.x &&
+        a.min.y <= b.max.y && b.min.y <= a.max.y &&
+        a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+// smallest power of two tile covering the lamp on screen
+int getLampTileSize(float importance) {
+    float pixels = importance * 0.5f * myWindow.getWindowDimensions().height;
+    int tileSize = LAMP_MIN_TILE_SIZE;
+    while (tileSize < LAMP_MAX_TILE_SIZE && tileSize < pixels) {
+        tileSize *= 2;
+    }
+    return tileSize;
+}
+
+// the largest free tile from largest down to smallest
+bool allocateLampTile(int largest, int smallest, gps::ShadowTile& tile) {
+    for (int tileSize = largest; tileSize >= smallest; tileSize /= 2) {
+        if (lampShadowAtlas.Allocate(tileSize, tile))
+            return true;
+    }
+    return false;
+}
+
+void releaseLampTile(StreetLamp& lamp) {
+    lampShadowAtlas.Free(lamp.tile);
+    lamp.tileReady = false;
+    lamp.tileValid = false;
+}
+
+// gives every lamp on screen an atlas tile sized by its importance
+void allocateLampTiles() {
+    gps::Frustum cameraFrustum;
+    cameraFrustum.extract(sceneProjection * view);
+    float cotHalfFov = sceneProjection[1][1];
+
+    std::vector<int> order;
+    for (size_t i = 0; i < streetLamps.size(); i++) {
+        StreetLamp& lamp = streetLamps[i];
+        if (cameraFrustum.intersects(getLampReach(lamp))) {
+            // projected radius of the lit area, as a fraction of half the screen height
+            float distance = glm::max(glm::length(myCamera.getCameraPosition() - lamp.position), 1.0f);
+            lamp.importance = lamp.range / distance * cotHalfFov;
+        }
+        else {
+            lamp.importance = 0.0f;
+        }
+
+        // tiles grow as soon as needed but only shrink to half their size, so they do not flicker
+        int wanted = lamp.importance > 0.0f ? getLampTileSize(lamp.importance) : 0;
+        if (wanted == 0 || wanted > lamp.requestedSize || wanted * 2 < lamp.requestedSize) {
+            releaseLampTile(lamp);
+            lamp.requestedSize = wanted;
+        }
+        order.push_back((int)i);
+    }
+
+    // the most important lamps pick first, the others fall back to smaller tiles; a fallback
+    // tile is traded for a larger one once the atlas has room again
+    std::sort(order.begin(), order.end(), [](int a, int b) {
+        return streetLamps[a].importance > streetLamps[b].importance;
+    });
+    for (int i : order) {
+        StreetLamp& lamp = streetLamps[i];
+        if (lamp.tile.size >= lamp.requestedSize)
+            continue;
+        gps::ShadowTile tile = {};
+        bool granted = allocateLampTile(lamp.requestedSize, glm::max(lamp.tile.size * 2, LAMP_MIN_TILE_SIZE), tile);
+
+        // a lamp left without a tile takes the tiles of the least important lamps, a freed tile
+        // is a free block itself so this stops at the first one; the lamps that lost theirs come
+        // later in the order and fall back to what is left
+        for (size_t j = order.size(); !granted && lamp.tile.size == 0 && j-- > 0;) {
+            StreetLamp& victim = streetLamps[order[j]];
+            if (victim.importance >= lamp.importance)
+                break;
+            if (victim.tile.size == 0)
+                continue;
+            releaseLampTile(victim);
+            granted = allocateLampTile(lamp.requestedSize, LAMP_MIN_TILE_SIZE, tile);
+        }
+
+        if (granted) {
+            releaseLampTile(lamp);
+            lamp.tile = tile;
+        }
+    }
+}
+
+void renderLampTile(StreetLamp& lamp, GLint lightSpaceTrMatrixLoc, gps::BoundingBox carBounds) {
+    PROFILE_ZONE("renderLampTile");
+    gps::Frustum lampFrustum;
+    lampFrustum.extract(lamp.lightSpaceTrMatrix);
+    shadowCasterMask.resize(cityMeshBounds.size());
+    for (size_t i = 0; i < cityMeshBounds.size(); i++) {
+        shadowCasterMask[i] = lampFrustum.intersects(cityMeshBounds[i]);
+    }
+    shadowMeshMask = &shadowCasterMask;
+
+    depthMapShader.useShaderProgram();
+    glUniformMatrix4fv(lightSpaceTrMatrixLoc, 1, GL_FALSE, glm::value_ptr(lamp.lightSpaceTrMatrix));
+    lampShadowAtlas.BeginTile(lamp.tile);
+    renderCity(depthMapShader, SHADOW_PASS);
+    if (lampFrustum.intersects(carBounds)) {
+        rendercarBody(depthMapShader, SHADOW_PASS);
+        renderFrontWheels(depthMapShader, SHADOW_PASS);
+        renderbackWheels(depthMapShader, SHADOW_PASS);
+    }
+    lampShadowAtlas.End();
+
+    shadowMeshMask = nullptr;
+    lamp.tileReady = true;
+    lamp.tileValid = true;
+    lamp.updateFrame = lampFrame;
+}
+
+// redraws a few of the out of date lamp tiles, the city never moves so only lamps the car
+// passes by have to be redrawn after their first update
+void renderLampShadows() {
+    PROFILE_ZONE("renderLampShadows");
+    lampFrame++;
+    allocateLampTiles();
+
+    gps::BoundingBox carBounds = getCarBounds();
+    bool carMoved = carBounds.min != lastCarBounds.min || carBounds.max != lastCarBounds.max;
+    std::vector<int> dirty;
+    for (size_t i = 0; i < streetLamps.size(); i++) {
+        StreetLamp& lamp = streetLamps[i];
+        if (lamp.tile.size == 0)
+            continue;
+        gps::BoundingBox reach = getLampReach(lamp);
+        if (carMoved && (boxesOverlap(reach, carBounds) || boxesOverlap(reach, lastCarBounds))) {
+            lamp.tileValid = false;
+        }
+        if (!lamp.tileValid) {
+            dirty.push_back((int)i);
+        }
+    }
+    lastCarBounds = carBounds;
+
+    // tiles never drawn come first, then the most important and the longest waiting ones
+    std::sort(dirty.begin(), dirty.end(), [](int a, int b) {
+        StreetLamp& lampA = streetLamps[a];
+        StreetLamp& lampB = streetLamps[b];
+        if (lampA.tileReady != lampB.tileReady)
+            return !lampA.tileReady;
+        float priorityA = lampA.importance * (float)(lampFrame - lampA.updateFrame);
+        float priorityB = lampB.importance * (float)(lampFrame - lampB.updateFrame);
+        return priorityA > priorityB;
+    });
+
+    depthMapShader.useShaderProgram();
+    GLint lightSpaceTrMatrixLoc = glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix");
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+    for (size_t i = 0; i < dirty.size() && (int)i < LAMP_UPDATES_PER_FRAME; i++) {
+        renderLampTile(streetLamps[dirty[i]], lightSpaceTrMatrixLoc, carBounds);
+    }
+    glDisable(GL_POLYGON_OFFSET_FILL);
+}
+
+void printClusterStats() {
+    if (!isStatsReportDue(clusterStatsFrame))
+        return;
+
+    std::cout << "Clustered lights: " << lightClusters.getLightCount() << " lights, "
+        << lightClusters.getIndexCount() << " cluster entries, at most "
+        << lightClusters.getMaxLightsPerCluster() << " per cluster, binned in "
+        << lightClusters.getBinningMs() << " ms" << std::endl;
+}
+
+// uploads the lamp shadows and the clustered night lights for the shader lighting the scene
+void uploadStreetLamps(gps::Shader shader) {
+    StreetLampData lampData[MAX_STREET_LAMPS];
+    int lampCount = (int)std::min(streetLamps.size(), (size_t)MAX_STREET_LAMPS);
+    for (int i = 0; i < lampCount; i++) {
+        StreetLamp& lamp = streetLamps[i];
+        lampData[i].lightSpaceTrMatrix = lamp.lightSpaceTrMatrix;
+        // lamps without a drawn tile are left unshadowed
+        lampData[i].shadowRect = lamp.tileReady ? lampShadowAtlas.getTileRect(lamp.tile) : glm::vec4(0.0f);
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, streetLampBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, lampCount * sizeof(StreetLampData), lampData);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, lampShadowAtlas.getTexture());
+    gps::RenderStats::countTextureBinds(1);
+
+    lightClusters.Update(nightLights, view, sceneProjection, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    lightClusters.Bind(shader, 9);
+    printClusterStats();
+}
+
+// view, sun and shadow uniforms of basic.frag, only for the features compiled into the shader
+void uploadSceneUniforms(gps::Shader shader, unsigned int features) {
+    shader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+
+    //the sun direction is the same for every fragment, move it to eye space once per frame
+    glm::vec3 lightDirEye = glm::normalize(glm::mat3(view) * getLightDirection());
+    glUniform3fv(glGetUniformLocation(shader.shaderProgram, "lightDirEye"), 1, glm::value_ptr(lightDirEye));
+    if (features & FEATURE_PER_FRAGMENT_TRANSFORMS) {
+        glUniform3fv(glGetUniformLocation(shader.shaderProgram, "lightDir"), 1, glm::value_ptr(getLightDirection()));
+    }
+    glUniform3fv(glGetUniformLocation(shader.shaderProgram, "lightColor"), 1,
+        glm::value_ptr(streetLampsOn ? nightLightColor : lightColor));
+
+    //bind the shadow maps
+    if (features & (FEATURE_CACHED_SHADOWS | FEATURE_SOFT_SHADOWS)) {
+        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "lightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
+        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "dynamicLightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(computeDynamicLightSpaceTrMatrix()));
+    }
+    if (features & FEATURE_CACHED_SHADOWS) {
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, staticShadowMap.getTexture());
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, dynamicShadowMap.getTexture());
+        gps::RenderStats::countTextureBinds(2);
+    }
+    if (features & FEATURE_SOFT_SHADOWS) {
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_2D, staticMomentMap.getTexture());
+        glActiveTexture(GL_TEXTURE7);
+        glBindTexture(GL_TEXTURE_2D, dynamicMomentMap.getTexture());
+        gps::RenderStats::countTextureBinds(2);
+    }
+    if (features & FEATURE_CASCADED_SHADOWS) {
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, cascadedShadowMap.getTexture());
+        gps::RenderStats::countTextureBinds(1);
+
+        glm::mat4 cascadeMatrices[gps::CascadedShadowMap::maxCascades];
+        float cascadeSplits[gps::CascadedShadowMap::maxCascades];
+        for (int i = 0; i < cascadedShadowMap.getCascadeCount(); i++) {
+            cascadeMatrices[i] = cascadedShadowMap.getLightSpaceTrMatrix(i);
+            cascadeSplits[i] = cascadedShadowMap.getSplitDepth(i);
+        }
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "cascadeCount"), cascadedShadowMap.getCascadeCount());
+        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "cascadeLightSpaceTrMatrix"),
+            cascadedShadowMap.getCascadeCount(), GL_FALSE, glm::value_ptr(cascadeMatrices[0]));
+        glUniform1fv(glGetUniformLocation(shader.shaderProgram, "cascadeSplits"),
+            cascadedShadowMap.getCascadeCount(), cascadeSplits);
+    }
+}
+
+void renderSceneObjects(gps::Shader shader) {
+    PROFILE_ZONE("renderSceneObjects");
+    if (depthPrepass) {
+        beginPass("depth prepass");
+        renderDepthPrepass();
+        endPass();
+    }
+
+    // the clear and the depth pre-pass are left out, only the fragment shading is timed
+    if (shadedPassQuery) {
+        glBeginQuery(GL_TIME_ELAPSED, shadedPassQuery);
+    }
+    beginPass("city");
+    renderCity(shader, COLOR_PASS);
+    endPass();
     
-    rendercarBody(depthMapShader, false);
-    renderFrontWheels(depthMapShader, false);
-    renderbackWheels(depthMapShader, false);
-    
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    beginPass("car");
+    gps::Shader carShader = colorLodShaders ? (*colorLodShaders)[carShaderLod.getTier(0)] : shader;
+    rendercarBody(carShader, COLOR_PASS);
+    renderFrontWheels(carShader, COLOR_PASS);
+    renderbackWheels(carShader, COLOR_PASS);
+    endPass();
+    if (shadedPassQuery) {
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+
+    if (depthPrepass) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+}
+
+void printShaderLodStats() {
+    if (!isStatsReportDue(shaderLodStatsFrame))
+        return;
 
+    std::cout << "Shader LOD: city meshes per tier";
+    for (int tier = 0; tier < cityShaderLod.getTierCount(); tier++) {
+        std::cout << " " << cityShaderLod.countObjects(tier);
+    }
+    std::cout << ", car at tier " << carShaderLod.getTier(0) << std::endl;
+}
+
+// the scene variant for the features, or one with fewer features until it is compiled, with the
+// uniforms of the frame
+// the street lamps are uploaded by the first call of a frame, later calls only bind the clusters
+gps::Shader prepareForwardShader(unsigned int features, bool firstShader) {
+    features = basicShaders.getReadyFeatures(features);
+    gps::Shader shader = basicShaders.get(features);
+    uploadSceneUniforms(shader, features);
+    if (features & FEATURE_CLUSTERED_LIGHTS) {
+        if (firstShader)
+            uploadStreetLamps(shader);
+        else
+            lightClusters.Bind(shader, 9);
+    }
+    if (features & FEATURE_FOG) {
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "fogDensity"), fogDensity);
+    }
+    return shader;
+}
 
+void renderForward(unsigned int features) {
+    PROFILE_ZONE("renderForward");
     glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    myBasicShader.useShaderProgram();
-    view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
-    lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(lightRotation)) * lightDir));
+    gps::Shader shader = prepareForwardShader(features, true);
 
-    //bind the shadow map
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
+    if (shaderLod) {
+        glm::vec3 cameraPosition = myCamera.getCameraPosition();
+        cityShaderLod.Update(cityMeshBounds, cameraPosition);
+        carShaderLod.Update({ getCarBounds() }, cameraPosition);
 
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
+        lodShaders.assign(1, shader);
+        for (int tier = 1; tier < cityShaderLod.getTierCount(); tier++) {
+            lodShaders.push_back(prepareForwardShader(getLodFeatures(features, tier), false));
+        }
+        colorLodShaders = &lodShaders;
+        printShaderLodStats();
+    }
 
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity"), fogDensity);
+    renderSceneObjects(shader);
+    colorLodShaders = nullptr;
+}
 
-    renderCity(myBasicShader, true);
-    
-    rendercarBody(myBasicShader, true);
-    renderFrontWheels(myBasicShader, true);
-    renderbackWheels(myBasicShader, true);
-    
+// the G-buffer pass resolves the sun shadow per pixel, the composite adds every light and the fog
+void renderDeferred(unsigned int features) {
+    PROFILE_ZONE("renderDeferred");
+    unsigned int gBufferFeatures = gBufferShaders.getReadyFeatures(features);
+    gps::Shader gBufferShader = gBufferShaders.get(gBufferFeatures);
+    beginPass("g-buffer");
+    gBuffer.Begin();
+    uploadSceneUniforms(gBufferShader, gBufferFeatures);
+    renderSceneObjects(gBufferShader);
+    gBuffer.End();
+    endPass();
 
+    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    features = deferredShaders.getReadyFeatures(features);
+    gps::Shader deferredShader = deferredShaders.get(features);
+    deferredShader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(deferredShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(deferredShader.shaderProgram, "inverseViewProjection"), 1, GL_FALSE,
+        glm::value_ptr(glm::inverse(sceneProjection * view)));
+    glUniform3fv(glGetUniformLocation(deferredShader.shaderProgram, "cameraPosition"), 1, glm::value_ptr(myCamera.getCameraPosition()));
+    glUniform3fv(glGetUniformLocation(deferredShader.shaderProgram, "lightDir"), 1, glm::value_ptr(getLightDirection()));
+    glUniform3fv(glGetUniformLocation(deferredShader.shaderProgram, "lightColor"), 1,
+        glm::value_ptr(streetLampsOn ? nightLightColor : lightColor));
+    if (features & FEATURE_FOG) {
+        glUniform1f(glGetUniformLocation(deferredShader.shaderProgram, "fogDensity"), fogDensity);
+    }
+    if (features & FEATURE_CLUSTERED_LIGHTS) {
+        uploadStreetLamps(deferredShader);
+    }
+
+    beginPass("composite");
+    gBuffer.Composite(deferredShader);
+    endPass();
+}
+
+void renderScene() {
+    PROFILE_ZONE("renderScene");
+
+
+    sceneAnimation();
+
+    lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+    // the cascades follow the camera
+    view = myCamera.getViewMatrix();
+    if (shadowsOn) {
+        beginPass("shadows");
+        renderShadowMaps();
+        endPass();
+    }
+    if (streetLampsOn) {
+        beginPass("lamp shadows");
+        renderLampShadows();
+        endPass();
+    }
+
+    unsigned int features = getSceneFeatures();
+    if (renderPath == RENDER_DEFERRED) {
+        beginPass("deferred");
+        renderDeferred(features);
+        endPass();
+    }
+    else {
+        beginPass("forward");
+        renderForward(features);
+        endPass();
+    }
+    // the cascades are fitted to what this pass left in the depth buffer
+    if (shadowsOn && shadowMode == SHADOW_SAMPLE_DISTRIBUTION) {
+        beginPass("depth range");
+        measureDepthRange();
+        endPass();
+    }
+
+    beginPass("light cube");
     lightShader.useShaderProgram();
 
     glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
@@ -684,51 +2094,546 @@ void renderScene() {
     glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
 
     lightCube.Draw(lightShader);
+    endPass();
 
     // render the sky box
+    beginPass("skybox");
     mySkyBox.Draw(skyboxShader, view, projection);
+    endPass();
+
+}
+
+// average and best GPU time of the shaded draws of one variant, after a few frames of warm-up
+void timeShaderVariant(unsigned int features, double& averageMs, double& minMs) {
+    const int warmupFrames = 10;
+    const int timedFrames = 100;
+
+    basicShaders.get(features);
+    double totalMs = 0.0;
+    minMs = 0.0;
+    for (int frame = 0; frame < warmupFrames + timedFrames; frame++) {
+        renderForward(features);
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(shadedPassQuery, GL_QUERY_RESULT, &elapsed);
+        myWindow.SwapBuffers();
+        myWindow.PollEvents();
+        if (frame < warmupFrames)
+            continue;
+
+        double ms = elapsed / 1000000.0;
+        totalMs += ms;
+        if (frame == warmupFrames || ms < minMs)
+            minMs = ms;
+    }
+    averageMs = totalMs / timedFrames;
+}
+
+// times the shaded draws of each scene shader variant with GPU timer queries, from the start
+// view with the animation stopped; every variant is also timed with the transforms done per
+// fragment as before they were hoisted into basic.vert, which is what the hoisting saves
+void runShaderBenchmark() {
+    struct BenchmarkCase {
+        const char* name;
+        unsigned int features;
+        SHADOW_MODE shadowMode;
+    };
+    const BenchmarkCase cases[] = {
+        { "sun only", 0, SHADOW_CACHED },
+        { "fog", FEATURE_FOG, SHADOW_CACHED },
+        { "spotlight", FEATURE_SPOTLIGHT, SHADOW_CACHED },
+        { "cached shadows", FEATURE_CACHED_SHADOWS, SHADOW_CACHED },
+        { "cascaded shadows", FEATURE_CASCADED_SHADOWS, SHADOW_CASCADED },
+        { "soft shadows", FEATURE_SOFT_SHADOWS, SHADOW_EXPONENTIAL },
+        { "fog, spotlight, cached shadows", FEATURE_FOG | FEATURE_SPOTLIGHT | FEATURE_CACHED_SHADOWS, SHADOW_CACHED },
+    };
+
+    // every pixel is shaded once, the timings follow the fragment cost
+    depthPrepass = true;
+    view = myCamera.getViewMatrix();
+
+    glGenQueries(1, &shadedPassQuery);
+    std::cout << "Shader benchmark at " << myWindow.getWindowDimensions().width << "x"
+        << myWindow.getWindowDimensions().height << ", average (best) ms, hoisted against per fragment transforms" << std::endl;
+    for (const BenchmarkCase& benchmarkCase : cases) {
+        shadowMode = benchmarkCase.shadowMode;
+        if (benchmarkCase.features & (FEATURE_CACHED_SHADOWS | FEATURE_CASCADED_SHADOWS | FEATURE_SOFT_SHADOWS)) {
+            renderShadowMaps();
+        }
+
+        double hoistedMs, hoistedMinMs, perFragmentMs, perFragmentMinMs;
+        timeShaderVariant(benchmarkCase.features, hoistedMs, hoistedMinMs);
+        timeShaderVariant(benchmarkCase.features | FEATURE_PER_FRAGMENT_TRANSFORMS, perFragmentMs, perFragmentMinMs);
+        double savedPercent = perFragmentMs > 0.0 ? 100.0 * (perFragmentMs - hoistedMs) / perFragmentMs : 0.0;
+        std::cout << "  " << benchmarkCase.name << ": " << hoistedMs << " (" << hoistedMinMs << ") against "
+            << perFragmentMs << " (" << perFragmentMinMs << "), " << savedPercent << "% saved" << std::endl;
+    }
+    glDeleteQueries(1, &shadedPassQuery);
+    shadedPassQuery = 0;
+    glCheckError();
+}
+
+void printGpuStats() {
+    if (!isStatsReportDue(gpuStatsFrame))
+        return;
+
+    std::cout << "GPU time per pass, average (min / max / p99) over the last "
+        << GPU_PROFILER_HISTORY << " frames, " << gpuProfiler.getDroppedFrames() << " frames dropped:" << std::endl;
+    for (const gps::GpuScopeStats& stats : gpuProfiler.getAllStats()) {
+        std::cout << "  " << std::string(stats.depth * 2, ' ') << stats.path.substr(stats.path.rfind('/') + 1) << ": "
+            << stats.averageMs << " ms (" << stats.minMs << " / " << stats.maxMs << " / " << stats.p99Ms << ")" << std::endl;
+    }
+}
+
+// the frame drawn so far, top row first as PPM wants it
+void writeCapture() {
+    std::vector<unsigned char> pixels;
+    myWindow.ReadPixels(pixels);
+    int width = myWindow.getWindowDimensions().width;
+    int height = myWindow.getWindowDimensions().height;
+
+    std::ofstream file(captureFile.c_str(), std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    for (int y = height - 1; y >= 0; y--) {
+        file.write((const char*)&pixels[(size_t)y * width * 3], width * 3);
+    }
+    if (file)
+        std::cout << "Capture: " << width << "x" << height << " frame written to " << captureFile << std::endl;
+    else
+        std::cerr << "Capture: cannot write " << captureFile << std::endl;
+}
+
+// a lap over the city from the start view: down to the car's street and along it while the car
+// drives, around the far blocks and back, with the sun turning over the last part
+void initDefaultBenchmarkPath() {
+    const gps::CameraKeyframe keyframes[] = {
+        { 0.0f, glm::vec3(33.0f, 20.5f, 15.0f), glm::vec3(33.0f, 20.6f, -15.0f), 0.0f, 0.0f },
+        { 5.0f, glm::vec3(60.0f, 10.0f, 0.0f), glm::vec3(68.0f, 1.0f, -25.0f), 5.0f, 0.0f },
+        { 10.0f, glm::vec3(76.0f, 6.0f, -35.0f), glm::vec3(68.0f, 1.0f, -55.0f), 15.0f, 0.0f },
+        { 15.0f, glm::vec3(40.0f, 25.0f, -80.0f), glm::vec3(30.0f, 5.0f, -30.0f), 25.0f, 0.0f },
+        { 20.0f, glm::vec3(-20.0f, 15.0f, -40.0f), glm::vec3(30.0f, 5.0f, -20.0f), 25.0f, 0.0f },
+        { 25.0f, glm::vec3(-20.0f, 30.0f, 30.0f), glm::vec3(33.0f, 0.0f, -30.0f), 25.0f, 20.0f },
+        { 30.0f, glm::vec3(33.0f, 20.5f, 15.0f), glm::vec3(33.0f, 20.6f, -15.0f), 25.0f, 45.0f },
+    };
+    benchmarkPath.Clear();
+    for (const gps::CameraKeyframe& keyframe : keyframes) {
+        benchmarkPath.addKeyframe(keyframe);
+    }
+}
+
+void applyPathState(const gps::CameraKeyframe& state) {
+    myCamera.setView(state.position, state.target);
+    carAnimationBool = true;
+    carDistance = state.carDistance;
+    // the wheels turn as when driving with Y, a degree per 0.01 forward
+    wheelAngle = std::fmod(-100.0f * state.carDistance, 360.0f);
+    lightAngle = state.lightAngle;
+}
+
+// compiles the variants the settings draw with, so no timed frame falls back to a plainer one
+void waitForSceneShaders(unsigned int features) {
+    if (renderPath == RENDER_DEFERRED) {
+        gBufferShaders.get(features & SHADOW_FEATURES);
+        deferredShaders.get(features & LIGHTING_FEATURES);
+        return;
+    }
+    basicShaders.get(features);
+    if (shaderLod) {
+        for (int tier = 1; tier < cityShaderLod.getTierCount(); tier++) {
+            basicShaders.get(getLodFeatures(features, tier));
+        }
+    }
+}
+
+void printFrameTimeSummary(const char* name, gps::FrameTimeSummary summary) {
+    std::cout << "  " << name << ": " << summary.averageMs << " ms average, p50 " << summary.p50Ms << ", p95 "
+        << summary.p95Ms << ", p99 " << summary.p99Ms << ", max " << summary.maxMs << std::endl;
+}
+
+// plays the benchmark path at a fixed timestep and writes the times and counters of every frame,
+// false when the path cannot be loaded or a frame time percentile is over its limit
+bool runBenchmark() {
+    if (benchmarkPathFile.empty()) {
+        initDefaultBenchmarkPath();
+    }
+    else if (!benchmarkPath.Load(benchmarkPathFile)) {
+        std::cerr << "Benchmark: no camera path in " << benchmarkPathFile << std::endl;
+        return false;
+    }
+    waitForSceneShaders(getSceneFeatures());
+
+    GLuint timerQuery;
+    glGenQueries(1, &timerQuery);
+    int pathFrames = (int)std::ceil(benchmarkPath.getDuration() / BENCHMARK_TIMESTEP) + 1;
+    benchmarkRecorder.Clear();
+    // the warm-up frames hold the first view, shadow maps and caches are filled before timing
+    for (int frame = -BENCHMARK_WARMUP_FRAMES; frame < pathFrames && !myWindow.shouldClose(); frame++) {
+        PROFILE_ZONE("benchmark frame");
+        float time = std::max(frame, 0) * BENCHMARK_TIMESTEP;
+        applyPathState(benchmarkPath.Sample(time));
+        reportShaderStartup();
+
+        std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+        glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+        if (gpuProfiling) {
+            gpuProfiler.BeginFrame();
+        }
+        renderScene();
+        if (gpuProfiling) {
+            gpuProfiler.EndFrame();
+            printGpuStats();
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now();
+
+        // waits for the GPU, swapping is left out so the swap interval does not count
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &elapsed);
+        std::chrono::steady_clock::time_point finished = std::chrono::steady_clock::now();
+        gps::RenderStats::BeginFrame();
+        if (frame == pathFrames - 1 && !captureFile.empty()) {
+            writeCapture();
+        }
 
+        myWindow.SwapBuffers();
+        myWindow.PollEvents();
+        if (frame < 0)
+            continue;
+
+        gps::BenchmarkFrame record;
+        record.time = time;
+        record.cpuMs = std::chrono::duration<double, std::milli>(submitted - frameStart).count();
+        record.gpuMs = elapsed / 1000000.0;
+        record.frameMs = std::chrono::duration<double, std::milli>(finished - frameStart).count();
+        record.counters = gps::RenderStats::getLastFrameTotals();
+        benchmarkRecorder.addFrame(record);
+    }
+    glDeleteQueries(1, &timerQuery);
+    glCheckError();
+
+    int frameCount = (int)benchmarkRecorder.getFrames().size();
+    std::cout << "Benchmark: " << frameCount << " frames at " << myWindow.getWindowDimensions().width << "x"
+        << myWindow.getWindowDimensions().height << ", " << benchmarkPath.getDuration() << " s path" << std::endl;
+    if (frameCount < pathFrames) {
+        std::cerr << "Benchmark: stopped after " << frameCount << " of " << pathFrames << " frames" << std::endl;
+        return false;
+    }
+    printFrameTimeSummary("CPU", benchmarkRecorder.getSummary(gps::TIMING_CPU));
+    printFrameTimeSummary("GPU", benchmarkRecorder.getSummary(gps::TIMING_GPU));
+    gps::FrameTimeSummary frameTimes = benchmarkRecorder.getSummary(gps::TIMING_FRAME);
+    printFrameTimeSummary("frame", frameTimes);
+    if (benchmarkRecorder.WriteCsv(benchmarkCsvFile)) {
+        std::cout << "  frames written to " << benchmarkCsvFile << std::endl;
+    }
+
+    bool passed = true;
+    if (benchmarkMaxP95 > 0.0 && frameTimes.p95Ms > benchmarkMaxP95) {
+        std::cout << "Benchmark FAILED: frame p95 " << frameTimes.p95Ms << " ms over " << benchmarkMaxP95 << " ms" << std::endl;
+        passed = false;
+    }
+    if (benchmarkMaxP99 > 0.0 && frameTimes.p99Ms > benchmarkMaxP99) {
+        std::cout << "Benchmark FAILED: frame p99 " << frameTimes.p99Ms << " ms over " << benchmarkMaxP99 << " ms" << std::endl;
+        passed = false;
+    }
+    return passed;
+}
+
+// the metrics of the benchmark run against the baseline, with a line per metric
+bool checkPerfGate(const std::vector<gps::PerfMetric>& metrics) {
+    gps::PerfGate perfGate;
+    if (!perfGate.LoadBaseline(perfBaselineFile))
+        return false;
+
+    std::vector<gps::PerfComparison> comparisons;
+    bool passed = perfGate.Compare(metrics, comparisons);
+    std::cout << "Perf gate against " << perfBaselineFile << ":" << std::endl;
+    gps::PerfGate::PrintReport(comparisons, std::cout);
+    return passed;
+}
+
+// one row of the statistics overlay, buffer uploads in KB
+std::string formatRenderCounters(const std::string& name, const gps::RenderCounters& counters) {
+    char line[128];
+    snprintf(line, sizeof(line), "%-14.14s%6d%10lld%10lld%5d%5d%6d%5d%8lld%6d", name.c_str(),
+        counters.drawCalls, counters.triangles, counters.vertices, counters.programSwitches, counters.textureBinds,
+        counters.uniformUploads, counters.bufferUploads, counters.bufferBytes / 1024, counters.culledObjects);
+    return line;
+}
+
+// last frame's totals and passes over the top left corner of the window
+void renderStatsOverlay() {
+    PROFILE_ZONE("renderStatsOverlay");
+    char header[128];
+    snprintf(header, sizeof(header), "%-14s%6s%10s%10s%5s%5s%6s%5s%8s%6s",
+        "pass", "draws", "tris", "verts", "prog", "tex", "unif", "buf", "KB", "cull");
+
+    std::vector<std::string> lines;
+    lines.push_back(header);
+    for (const gps::PassStats& pass : gps::RenderStats::getLastFramePasses()) {
+        lines.push_back(formatRenderCounters(pass.name, pass.counters));
+    }
+    lines.push_back(formatRenderCounters("total", gps::RenderStats::getLastFrameTotals()));
+
+    statsOverlay.Draw(textShader, lines, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height,
+        STATS_OVERLAY_SCALE);
+}
+
+// the startup state a recorded session depends on, the toggles after it are recorded as keys
+gps::InputSettings getInputSettings() {
+    gps::InputSettings settings;
+    settings.width = myWindow.getWindowDimensions().width;
+    settings.height = myWindow.getWindowDimensions().height;
+    settings.deferred = renderPath == RENDER_DEFERRED;
+    settings.depthPrepass = depthPrepass;
+    settings.night = streetLampsOn;
+    return settings;
+}
+
+// the replayed session's flags replace the command line's, a different framebuffer size fails
+bool applyInputSettings(const gps::InputSettings& settings) {
+    gps::InputSettings current = getInputSettings();
+    if (settings.width != current.width || settings.height != current.height) {
+        std::cerr << "ERROR: the input log was recorded at " << settings.width << "x" << settings.height
+            << ", this framebuffer is " << current.width << "x" << current.height << std::endl;
+        return false;
+    }
+    if (settings.deferred != current.deferred || settings.depthPrepass != current.depthPrepass || settings.night != current.night)
+        std::cout << "Input replay: using the recorded settings" << (settings.deferred ? " --deferred" : "")
+            << (settings.depthPrepass ? " --depth-prepass" : "") << (settings.night ? " --night" : "")
+            << " instead of the command line's" << std::endl;
+    renderPath = settings.deferred ? RENDER_DEFERRED : RENDER_FORWARD;
+    depthPrepass = settings.depthPrepass;
+    streetLampsOn = settings.night;
+    return true;
 }
 
 void cleanup() {
+    cityOcclusionCuller.Delete();
+    staticShadowMap.Delete();
+    dynamicShadowMap.Delete();
+    cascadedShadowMap.Delete();
+    depthRange.Delete();
+    staticMomentMap.Delete();
+    dynamicMomentMap.Delete();
+    lampShadowAtlas.Delete();
+    lightClusters.Delete();
+    gpuProfiler.Delete();
+    statsOverlay.Delete();
+    gBuffer.Delete();
+    basicShaders.Delete();
+    gBufferShaders.Delete();
+    deferredShaders.Delete();
+    glDeleteBuffers(1, &streetLampBuffer);
     myWindow.Delete();
     //cleanup code for your own data
 }
 
 int main(int argc, const char* argv[]) {
 
+    // before the window, so the loaders are recorded as well
+    bool headless = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cpu-profile") == 0)
+            gps::CpuProfiler::setEnabled(true);
+        else if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+    }
+    gps::CpuProfiler::setThreadName("main");
+
     try {
-        initOpenGLWindow();
+        initOpenGLWindow(headless);
     }
     catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
+        shutdownCpuProfiler();
         return EXIT_FAILURE;
     }
+    gps::RenderStats::InstallHooks();
+
+    bool bakePvsOnly = false;
+    bool shaderBenchmark = false;
+    bool benchmark = false;
+    std::string recordInputFile;
+    std::string replayInputFile;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bake-pvs") == 0)
+            bakePvsOnly = true;
+        else if (strcmp(argv[i], "--shader-bench") == 0)
+            shaderBenchmark = true;
+        else if (strcmp(argv[i], "--gpu-profile") == 0)
+            gpuProfiling = true;
+        else if (strcmp(argv[i], "--deferred") == 0)
+            renderPath = RENDER_DEFERRED;
+        else if (strcmp(argv[i], "--no-shader-cache") == 0)
+            gps::Shader::setBinaryCacheDirectory("");
+        else if (strcmp(argv[i], "--depth-prepass") == 0)
+            depthPrepass = true;
+        else if (strcmp(argv[i], "--night") == 0)
+            streetLampsOn = true;
+        else if (strcmp(argv[i], "--benchmark") == 0)
+            benchmark = true;
+        else if (strcmp(argv[i], "--benchmark-path") == 0 && i + 1 < argc)
+            benchmarkPathFile = argv[++i];
+        else if (strcmp(argv[i], "--benchmark-csv") == 0 && i + 1 < argc)
+            benchmarkCsvFile = argv[++i];
+        else if (strcmp(argv[i], "--max-p95") == 0 && i + 1 < argc)
+            benchmarkMaxP95 = atof(argv[++i]);
+        else if (strcmp(argv[i], "--max-p99") == 0 && i + 1 < argc)
+            benchmarkMaxP99 = atof(argv[++i]);
+        else if (strcmp(argv[i], "--perf-gate") == 0 && i + 1 < argc) {
+            perfBaselineFile = argv[++i];
+            benchmark = true;
+        }
+        else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc) {
+            writeBaselineFile = argv[++i];
+            benchmark = true;
+        }
+        else if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc)
+            recordInputFile = argv[++i];
+        else if (strcmp(argv[i], "--replay-input") == 0 && i + 1 < argc)
+            replayInputFile = argv[++i];
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frameLimit = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+            captureFile = argv[++i];
+    }
 
     initOpenGLState();
-    initModels();
+
+    if (bakePvsOnly) {
+        initModels();
+        bakePvs();
+        cleanup();
+        shutdownCpuProfiler();
+        return EXIT_SUCCESS;
+    }
+
+    // the shaders compile on driver threads while the models and textures load
+    shaderStartupStart = std::chrono::steady_clock::now();
     initShaders();
+    std::chrono::steady_clock::time_point modelsStart = std::chrono::steady_clock::now();
+    initModels();
+    initFaces();
+    std::chrono::steady_clock::time_point shadersWaitStart = std::chrono::steady_clock::now();
+    finishShaders();
+    std::chrono::steady_clock::time_point shadersReady = std::chrono::steady_clock::now();
+    std::cout << "Shader startup: submitted in "
+        << std::chrono::duration<double, std::milli>(modelsStart - shaderStartupStart).count() << " ms, models loaded in "
+        << std::chrono::duration<double, std::milli>(shadersWaitStart - modelsStart).count() << " ms, then waited "
+        << std::chrono::duration<double, std::milli>(shadersReady - shadersWaitStart).count() << " ms for the fixed programs, "
+        << gps::Shader::getCachedProgramCount() << " programs from the binary cache, "
+        << gps::Shader::getCompiledProgramCount() << " compiled" << std::endl;
+
     initUniforms();
     initFBO();
+    initOcclusionCulling();
+    initShadowCasters();
+    initShaderLod();
+    initStreetLamps();
+    initNightLights();
+    initPvs();
+    gpuProfiler.Create(GPU_PROFILER_HISTORY);
+    statsOverlay.Create();
     setWindowCallbacks();
 
-    initFaces();
     initSkyBoxShader();
 
+    if (shaderBenchmark) {
+        runShaderBenchmark();
+        cleanup();
+        shutdownCpuProfiler();
+        return EXIT_SUCCESS;
+    }
+
+    if (benchmark) {
+        bool passed = runBenchmark();
+        // a run over its frame time limits is still compared, the report shows what moved
+        if (!benchmarkRecorder.getFrames().empty()) {
+            std::vector<gps::PerfMetric> metrics = gps::PerfGate::CollectMetrics(benchmarkRecorder);
+            if (!perfBaselineFile.empty())
+                passed = checkPerfGate(metrics) && passed;
+            if (!writeBaselineFile.empty() && gps::PerfGate::SaveBaseline(writeBaselineFile, metrics))
+                std::cout << "Perf baseline: " << metrics.size() << " metrics written to " << writeBaselineFile << std::endl;
+        }
+        cleanup();
+        shutdownCpuProfiler();
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // the session starts from the recorded settings and cursor, the window size cannot change
+    if (!replayInputFile.empty()) {
+        if (!inputLog.Load(replayInputFile) || !applyInputSettings(inputLog.getSettings())) {
+            cleanup();
+            shutdownCpuProfiler();
+            return EXIT_FAILURE;
+        }
+        inputReplay = true;
+        oldXPos = inputLog.getStartCursorX();
+        oldYPos = inputLog.getStartCursorY();
+        std::cout << "Input replay: " << inputLog.getEventCount() << " events over " << inputLog.getFrameCount()
+            << " frames from " << replayInputFile << std::endl;
+    }
+    else if (!recordInputFile.empty()) {
+        inputLog.BeginRecording(recordInputFile, oldXPos, oldYPos, getInputSettings());
+    }
+
+    completeFrames = inputReplay || myWindow.isHeadless() || !captureFile.empty();
+    if (myWindow.isHeadless() && frameLimit == 0 && !inputReplay) {
+        frameLimit = HEADLESS_DEFAULT_FRAMES;
+    }
+
     glCheckError();
     // application loop
-    while (!glfwWindowShouldClose(myWindow.getWindow())) {
+    while (!myWindow.shouldClose()) {
         /*angle += 1.0f;
         if (angle >= 360)
             angle = 0.0f;*/
+        PROFILE_ZONE("frame");
+        gps::RenderStats::BeginFrame();
         processMovement();
+        if (completeFrames) {
+            waitForSceneShaders(getSceneFeatures());
+        }
+        if (gpuProfiling) {
+            gpuProfiler.BeginFrame();
+        }
         renderScene();
+        reportShaderStartup();
+        if (gpuProfiling) {
+            gpuProfiler.EndFrame();
+            printGpuStats();
+        }
+        if (statsOverlayOn) {
+            renderStatsOverlay();
+        }
 
-        glfwPollEvents();
-        glfwSwapBuffers(myWindow.getWindow());
+        {
+            PROFILE_ZONE("glfwPollEvents");
+            myWindow.PollEvents();
+        }
+        if (inputReplay) {
+            replayInput();
+        }
+        if (frameLimit > 0 && frameIndex + 1 >= frameLimit) {
+            myWindow.setShouldClose(true);
+        }
+        // the last frame, before swapping leaves the back buffer undefined
+        if (myWindow.shouldClose() && !captureFile.empty()) {
+            writeCapture();
+        }
+        {
+            PROFILE_ZONE("glfwSwapBuffers");
+            myWindow.SwapBuffers();
+        }
+        frameIndex++;
     }
 
+    if (inputLog.isRecording()) {
+        inputLog.EndRecording(frameIndex);
+        std::cout << "Input recording: " << frameIndex << " frames written to " << recordInputFile << std::endl;
+    }
     cleanup();
+    shutdownCpuProfiler();
 
     return EXIT_SUCCESS;
 }
@@ -1,27 +1,71 @@
 #version 410 core
 
-in vec3 fPosition;
-in vec3 fNormal;
 in vec2 fTexCoords;
 in vec4 fragPosLightSpace;
-
+in vec4 fragPosDynamicLightSpace;
+
+#ifdef GBUFFER_PASS
+// surface attributes for deferredLighting.frag: albedo, world normal, sun visibility and specular colour
+layout(location = 0) out vec4 gAlbedo;
+layout(location = 1) out vec4 gNormal;
+layout(location = 2) out vec4 gMaterial;
+#else
 out vec4 fColor;
+#endif
 
 in vec3 fragPos;
 
 //matrices
-uniform mat4 model;
 uniform mat4 view;
-uniform mat3 normalMatrix;
-uniform mat3 lightDirMatrix;
 
-//lighting
+#ifdef PER_FRAGMENT_TRANSFORMS
+// reference for --shader-bench only: the object space inputs are transformed again wherever they
+// are used, and the sun direction is moved to eye space per fragment, as before basic.vert and the
+// CPU took this over; the lighting is otherwise the same
+in vec3 fPosition;
+in vec3 fNormal;
+uniform mat4 model;
+uniform mat3 normalMatrix;
 uniform vec3 lightDir;
+#define fPosEye ((view * model * vec4(fPosition, 1.0f)).xyz)
+#define fNormalEye (normalMatrix * fNormal)
+#define fNormalWorld (mat3(model) * fNormal)
+#define fFogDistance length(fPosEye)
+#define lightDirEye normalize(vec3(view * vec4(lightDir, 0.0f)))
+#else
+in vec3 fPosEye;
+in vec3 fNormalEye;
+in vec3 fNormalWorld;
+#ifdef FOG
+in float fFogDistance;
+#endif
+
+//lighting, lightDirEye is the sun direction in eye space, normalized once per frame
+uniform vec3 lightDirEye;
+#endif
 uniform vec3 lightColor;
 // textures
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
 uniform sampler2D shadowMap;
+uniform sampler2D dynamicShadowMap;
+uniform sampler2DArray cascadeShadowMap;
+uniform sampler2D shadowMoments;
+uniform sampler2D dynamicShadowMoments;
+
+// shader LOD tiers of distant objects: NO_SPECULAR drops the specular terms, VERTEX_LIGHTING
+// replaces the whole lighting with the sun and fog computed per vertex by basic.vert
+#ifdef VERTEX_LIGHTING
+in vec3 fVertexLight;
+in float fFogFactor;
+#endif
+
+// shadows, one of the features below or none at all:
+// CACHED_SHADOWS cached city map and car map, CASCADED_SHADOWS cascades (fixed or fitted to the
+// visible depth range), SOFT_SHADOWS the cached maps as exponential variance maps
+uniform int cascadeCount;
+uniform mat4 cascadeLightSpaceTrMatrix[4];
+uniform float cascadeSplits[4];
 
 //components
 vec3 ambient;
@@ -30,12 +74,10 @@ vec3 diffuse;
 vec3 specular;
 float specularStrength = 0.5f;
 
-//fog
-uniform int foginit;
+//fog, with FOG
 uniform float fogDensity;
 
-// spotlight
-uniform int spotLightInitialize;
+// spotlight, with SPOTLIGHT
 float shininess = 10.0f;
 float spotLightQuadratic = 0.2f;
 float spotLightLinear = 0.22f;
@@ -51,17 +93,41 @@ uniform float spotlight2;
 uniform vec3 spotLightDirection;
 uniform vec3 spotLightPosition;
 
-float computeShadow()
+// street lamp shadows, tiles of one atlas
+struct StreetLamp {
+	mat4 lightSpaceTrMatrix;
+	// offset in xy, scale in z, w is 0 for lamps without a shadow
+	vec4 shadowRect;
+};
+
+layout(std140) uniform StreetLamps {
+	StreetLamp streetLamps[32];
+};
+
+uniform sampler2D lampShadowAtlas;
+
+// night lights binned into clusters of the view frustum, with CLUSTERED_LIGHTS
+// 4 texels per light: position and range, colour and outer cutoff, direction and inner cutoff, shadow
+uniform samplerBuffer clusterLightData;
+// offset and count of each cluster's lights in clusterLightIndices
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLightIndices;
+uniform ivec3 clusterCount;
+uniform vec2 clusterTileSize;
+uniform float clusterDepthScale;
+uniform float clusterDepthBias;
+
+float computeShadowMap(sampler2D map, vec4 fragPosLight)
 {
 
 	//perform perspective divide
-	vec3 normalizedCoords= fragPosLightSpace.xyz / fragPosLightSpace.w;
+	vec3 normalizedCoords= fragPosLight.xyz / fragPosLight.w;
 
 	//tranform from [-1,1] range to [0,1] range
 	normalizedCoords = normalizedCoords * 0.5 + 0.5;
 
 	//get closest depth value from lights perspective
-	float closestDepth = texture(shadowMap, normalizedCoords.xy).r;
+	float closestDepth = texture(map, normalizedCoords.xy).r;
 
 	//get depth of current fragment from lights perspective
 	float currentDepth = normalizedCoords.z;
@@ -77,63 +143,128 @@ float computeShadow()
 
 }
 
+// the cascade is picked by the view depth of the fragment
+float computeCascadeShadow()
+{
+	float depth = -fPosEye.z;
+	if (depth > cascadeSplits[cascadeCount - 1])
+		return 0.0f;
+
+	int cascade = cascadeCount - 1;
+	for (int i = 0; i < cascadeCount - 1; i++) {
+		if (depth < cascadeSplits[i]) {
+			cascade = i;
+			break;
+		}
+	}
+
+	vec4 fragPosLight = cascadeLightSpaceTrMatrix[cascade] * vec4(fragPos, 1.0f);
+	vec3 normalizedCoords = fragPosLight.xyz / fragPosLight.w * 0.5 + 0.5;
+	if (normalizedCoords.z > 1.0f)
+		return 0.0f;
 
-void computeDirLight()
+	// casters are drawn with a slope scaled offset, a small constant bias is enough
+	float closestDepth = texture(cascadeShadowMap, vec3(normalizedCoords.xy, cascade)).r;
+	float bias = 0.001f;
+	return normalizedCoords.z - bias > closestDepth ? 1.0 : 0.0;
+}
+
+// upper bound of the lit fraction from the mean and variance of the occluder depth
+float chebyshevUpperBound(vec2 moments, float depth, float minVariance)
 {
-	vec3 cameraPosEye = vec3(0.0f);
+	if (depth <= moments.x)
+		return 1.0f;
+
+	float variance = max(moments.y - moments.x * moments.x, minVariance);
+	float delta = depth - moments.x;
+	float pMax = variance / (variance + delta * delta);
+
+	//cut the tail to reduce light bleeding where shadows overlap
+	return clamp((pMax - 0.2f) / 0.8f, 0.0f, 1.0f);
+}
 
-    //compute eye space coordinates
-    vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-    vec3 normalEye = normalize(normalMatrix * fNormal);
+// lit fraction from a filtered exponential variance map, exponents as in shadowMoments.frag
+float computeMomentVisibility(sampler2D map, vec4 fragPosLight)
+{
+	vec3 normalizedCoords = fragPosLight.xyz / fragPosLight.w * 0.5 + 0.5;
+	if (normalizedCoords.z > 1.0f)
+		return 1.0f;
 
-    //normalize light direction
-    vec3 lightDirN = vec3(normalize(view * vec4(lightDir, 0.0f)));
-	//vec3 lightDirN = normalize(lightDir);
+	float depth = normalizedCoords.z * 2.0f - 1.0f;
+	float positive = exp(40.0f * depth);
+	float negative = -exp(-5.0f * depth);
 
-    //compute view direction (in eye coordinates, the viewer is situated at the origin
-    vec3 viewDir = normalize(cameraPosEye - fPosEye.xyz);
+	vec4 moments = texture(map, normalizedCoords.xy);
+	float positiveVariance = 0.0001f * 40.0f * positive;
+	float negativeVariance = 0.0001f * 5.0f * negative;
+	return min(chebyshevUpperBound(moments.xy, positive, positiveVariance * positiveVariance),
+		chebyshevUpperBound(moments.zw, negative, negativeVariance * negativeVariance));
+}
 
+// static map of the city, combined with the map of the moving car
+float computeShadow()
+{
+#if defined(SOFT_SHADOWS)
+	return 1.0f - computeMomentVisibility(shadowMoments, fragPosLightSpace) * computeMomentVisibility(dynamicShadowMoments, fragPosDynamicLightSpace);
+#elif defined(CASCADED_SHADOWS)
+	return computeCascadeShadow();
+#elif defined(CACHED_SHADOWS)
+	return max(computeShadowMap(shadowMap, fragPosLightSpace), computeShadowMap(dynamicShadowMap, fragPosDynamicLightSpace));
+#else
+	return 0.0f;
+#endif
+}
+
+
+void computeDirLight(vec3 normalEye, vec3 viewDir)
+{
     //compute ambient light
     ambient = ambientStrength * lightColor;
 
     //compute diffuse light
-    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+    diffuse = max(dot(normalEye, lightDirEye), 0.0f) * lightColor;
 
     //compute specular light
-    vec3 reflectDir = reflect(-lightDirN, normalEye);
+#ifdef NO_SPECULAR
+    specular = vec3(0.0f);
+#else
+    vec3 reflectDir = reflect(-lightDirEye, normalEye);
     float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
     specular = specularStrength * specCoeff * lightColor;
+#endif
 }
 
 
+#ifdef FOG
 float computeFog()
 {
- vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
- float fragmentDistance = length(fPosEye.xyz);
- float fogFactor = exp(-pow(fragmentDistance * fogDensity, 2));
+ float fogFactor = exp(-pow(fFogDistance * fogDensity, 2));
 
  return clamp(fogFactor, 0.0f, 1.0f);
 }
+#endif
 
 
 
-// spot light
-vec3 computeLightSpotComponents() {
-	vec3 cameraPosEye = vec3(0.0f);
-	vec3 lightDir = normalize(spotLightPosition - fragPos);
-	vec3 normalEye = normalize(normalMatrix * fNormal);
-	vec3 lightDirN = normalize(lightDirMatrix * lightDir);
-	vec3 viewDirN = normalize(cameraPosEye - (view * model * vec4(fPosition, 1.0f)).xyz);
-	vec3 halfVector = normalize(lightDirN + viewDirN);
+// spot light, diffuse in world space and specular in eye space
+vec3 computeLightSpotComponents(vec3 normalWorld, vec3 normalEye, vec3 viewDir, vec3 albedo, vec3 specularColor) {
+	vec3 toLight = spotLightPosition - fragPos;
+	float distance = length(toLight);
+	vec3 lightDir = toLight / distance;
 
-	float diff = max(dot(fNormal, lightDir), 0.0f);
+	float diff = max(dot(normalWorld, lightDir), 0.0f);
+#ifdef NO_SPECULAR
+	float spec = 0.0f;
+#else
+	vec3 lightDirN = normalize(mat3(view) * lightDir);
+	vec3 halfVector = normalize(lightDirN + viewDir);
 	float spec = pow(max(dot(normalEye, halfVector), 0.0f), shininess);
-	float distance = length(spotLightPosition - fragPos);
+#endif
 	float attenuation = 1.0f / (spotLightConstant + spotLightLinear * distance + spotLightQuadratic * distance * distance);
 	
-	vec3 ambient = spotLightColor * spotLightAmbient * vec3(texture(diffuseTexture, fTexCoords));
-	vec3 diffuse = spotLightColor * spotLightSpecular * diff * vec3(texture(diffuseTexture, fTexCoords));
-	vec3 specular = spotLightColor * spotLightSpecular * spec * vec3(texture(specularTexture, fTexCoords));
+	vec3 ambient = spotLightColor * spotLightAmbient * albedo;
+	vec3 diffuse = spotLightColor * spotLightSpecular * diff * albedo;
+	vec3 specular = spotLightColor * spotLightSpecular * spec * specularColor;
 
 	ambient *= attenuation;
 	diffuse *= attenuation;
@@ -142,36 +273,120 @@ vec3 computeLightSpotComponents() {
 	return ambient + diffuse + specular;
 }
 
+float computeLampShadow(int lamp)
+{
+	vec4 shadowRect = streetLamps[lamp].shadowRect;
+	if (shadowRect.w == 0.0f)
+		return 0.0f;
+
+	vec4 fragPosLight = streetLamps[lamp].lightSpaceTrMatrix * vec4(fragPos, 1.0f);
+	vec3 normalizedCoords = fragPosLight.xyz / fragPosLight.w * 0.5 + 0.5;
+	if (normalizedCoords.z > 1.0f)
+		return 0.0f;
+
+	//stay half a texel inside the tile so neighbouring tiles never bleed in
+	float halfTexel = 0.5f / float(textureSize(lampShadowAtlas, 0).x);
+	vec2 tileCoords = shadowRect.xy + clamp(normalizedCoords.xy * shadowRect.z, vec2(halfTexel), vec2(shadowRect.z - halfTexel));
+	float closestDepth = texture(lampShadowAtlas, tileCoords).r;
+	float bias = 0.0005f;
+	return normalizedCoords.z - bias > closestDepth ? 1.0 : 0.0;
+}
+
+vec3 computeClusteredLights(vec3 normal, vec3 albedo)
+{
+	float depth = max(-fPosEye.z, 0.0001f);
+	int slice = clamp(int(log(depth) * clusterDepthScale + clusterDepthBias), 0, clusterCount.z - 1);
+	ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterTileSize), clusterCount.xy - 1);
+	uvec2 lights = texelFetch(clusterGrid, (slice * clusterCount.y + tile.y) * clusterCount.x + tile.x).xy;
+
+	vec3 color = vec3(0.0f);
+	for (uint i = 0u; i < lights.y; i++) {
+		int light = int(texelFetch(clusterLightIndices, int(lights.x + i)).r) * 4;
+		vec4 positionRange = texelFetch(clusterLightData, light);
+
+		vec3 toLight = positionRange.xyz - fragPos;
+		float distance = length(toLight);
+		if (distance > positionRange.w)
+			continue;
+
+		vec4 colorOuterCutoff = texelFetch(clusterLightData, light + 1);
+		vec4 directionInnerCutoff = texelFetch(clusterLightData, light + 2);
+		vec3 lightDirN = toLight / distance;
+		float diff = max(dot(normal, lightDirN), 0.0f);
+		//point lights have an outer cutoff of -1 and are never cut
+		float cone = colorOuterCutoff.w < -0.5f ? 1.0f :
+			smoothstep(colorOuterCutoff.w, directionInnerCutoff.w, dot(-lightDirN, directionInnerCutoff.xyz));
+		if (cone * diff <= 0.0f)
+			continue;
+
+		float falloff = 1.0f - distance / positionRange.w;
+		float shadow = 0.0f;
+		int shadowIndex = int(texelFetch(clusterLightData, light + 3).x);
+		if (shadowIndex >= 0)
+			shadow = computeLampShadow(shadowIndex);
+		color += colorOuterCutoff.rgb * albedo * diff * cone * falloff * falloff * (1.0f - shadow);
+	}
+	return color;
+}
+
+#ifdef GBUFFER_PASS
+// the sun shadow is resolved here, the shadow maps are not needed by the composite
+void main()
+{
+	gAlbedo = vec4(texture(diffuseTexture, fTexCoords).rgb, 1.0f);
+	gNormal = vec4(normalize(fNormalWorld), 0.0f);
+	gMaterial = vec4(1.0f - computeShadow(), texture(specularTexture, fTexCoords).rgb);
+}
+#elif defined(VERTEX_LIGHTING)
+// lit and fogged per vertex, a single texture fetch per fragment
+void main()
+{
+	vec3 color = min(fVertexLight * texture(diffuseTexture, fTexCoords).rgb, 1.0f);
+	fColor = mix(vec4(0.5f, 0.5f, 0.5f, 1.0f), vec4(color, 1.0f), fFogFactor);
+}
+#else
 void main() 
 {
-    computeDirLight();
+	// interpolated once, shared by all the lights below
+	vec3 normalEye = normalize(fNormalEye);
+	vec3 normalWorld = normalize(fNormalWorld);
+	//in eye coordinates the viewer is situated at the origin
+	vec3 viewDir = normalize(-fPosEye);
+	vec3 albedo = texture(diffuseTexture, fTexCoords).rgb;
+#ifdef NO_SPECULAR
+	vec3 specularColor = vec3(0.0f);
+#else
+	vec3 specularColor = texture(specularTexture, fTexCoords).rgb;
+#endif
+
+    computeDirLight(normalEye, viewDir);
 
     //compute final vertex color
 	float shadow = computeShadow();
 
-    vec3 color = min((ambient + (1.0f - shadow) * diffuse) * texture(diffuseTexture, fTexCoords).rgb 
-	+ (1.0f - shadow) * specular * texture(specularTexture, fTexCoords).rgb, 1.0f);
+    vec3 color = min((ambient + (1.0f - shadow) * diffuse) * albedo 
+	+ (1.0f - shadow) * specular * specularColor, 1.0f);
 
 	//vec3 color = min((ambient + diffuse) * texture(diffuseTexture, fTexCoords).rgb 
 	//+ specular * texture(specularTexture, fTexCoords).rgb, 1.0f);
 
-	float fogFactor = computeFog();
-	vec4 fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
-
 	// spotlight
-	if (spotLightInitialize == 1){
-	color += computeLightSpotComponents();
-	}
+#ifdef SPOTLIGHT
+	color += computeLightSpotComponents(normalWorld, normalEye, viewDir, albedo, specularColor);
+#endif
 
+#ifdef CLUSTERED_LIGHTS
+	color += computeClusteredLights(normalWorld, albedo);
+#endif
 
-	if ( foginit == 0)
-	{
-		fColor = vec4(color, 1.0f);
-	}
-	else
-	{
-		fColor = mix(fogColor, min(vec4(color, 1.0f), 1.0f), fogFactor);
-	}
+#ifdef FOG
+	float fogFactor = computeFog();
+	vec4 fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
+	fColor = mix(fogColor, min(vec4(color, 1.0f), 1.0f), fogFactor);
+#else
+	fColor = vec4(color, 1.0f);
+#endif
 
     //fColor = vec4(color, 1.0f);
 }
+#endif
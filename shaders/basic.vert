@@ -4,24 +4,74 @@ layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
-out vec3 fPosition;
-out vec3 fNormal;
 out vec2 fTexCoords;
 out vec4 fragPosLightSpace;
+out vec4 fragPosDynamicLightSpace;
 
 out vec3 fragPos;
+#ifdef PER_FRAGMENT_TRANSFORMS
+// benchmark reference, basic.frag transforms the object space inputs itself
+out vec3 fPosition;
+out vec3 fNormal;
+#else
+// eye space position and normal and world space normal, so the fragment shader does not
+// transform them again for every fragment
+out vec3 fPosEye;
+out vec3 fNormalEye;
+out vec3 fNormalWorld;
+#ifdef FOG
+out float fFogDistance;
+#endif
+#endif
+
+// distant objects are lit by the sun and fogged here instead of per fragment
+#ifdef VERTEX_LIGHTING
+out vec3 fVertexLight;
+out float fFogFactor;
+
+uniform vec3 lightDirEye;
+uniform vec3 lightColor;
+uniform float fogDensity;
+#endif
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform mat3 normalMatrix;
 uniform mat4 lightSpaceTrMatrix;
+uniform mat4 dynamicLightSpaceTrMatrix;
+
+// the depth pre-pass writes the same depth values, see depthPrepass.vert
+invariant gl_Position;
 
 void main() 
 {
 	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fPosition = vPosition;
-	fNormal = vNormal;
 	fTexCoords = vTexCoords;
 	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	fragPosDynamicLightSpace = dynamicLightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
 	fragPos = vec3(model* vec4(vPosition,1.0f));
+
+	vec4 posEye = view * model * vec4(vPosition, 1.0f);
+#ifdef PER_FRAGMENT_TRANSFORMS
+	fPosition = vPosition;
+	fNormal = vNormal;
+#else
+	fPosEye = posEye.xyz;
+	fNormalEye = normalMatrix * vNormal;
+	fNormalWorld = mat3(model) * vNormal;
+#ifdef FOG
+	fFogDistance = length(posEye.xyz);
+#endif
+#endif
+
+#ifdef VERTEX_LIGHTING
+	// ambient strength as in basic.frag
+	fVertexLight = (0.2f + max(dot(normalize(normalMatrix * vNormal), lightDirEye), 0.0f)) * lightColor;
+#ifdef FOG
+	fFogFactor = clamp(exp(-pow(length(posEye.xyz) * fogDensity, 2)), 0.0f, 1.0f);
+#else
+	fFogFactor = 1.0f;
+#endif
+#endif
 }
@@ -0,0 +1,22 @@
+#version 410 core
+
+uniform sampler2D source;
+// one texel along the blur axis
+uniform vec2 direction;
+
+out vec4 fColor;
+
+// 9 tap gaussian, taken as 5 bilinear samples between texel pairs
+const float offsets[3] = float[](0.0f, 1.3846153846f, 3.2307692308f);
+const float weights[3] = float[](0.2270270270f, 0.3162162162f, 0.0702702703f);
+
+void main()
+{
+	vec2 texCoords = gl_FragCoord.xy / vec2(textureSize(source, 0));
+
+	fColor = textureLod(source, texCoords, 0.0f) * weights[0];
+	for (int i = 1; i < 3; i++) {
+		fColor += textureLod(source, texCoords + direction * offsets[i], 0.0f) * weights[i];
+		fColor += textureLod(source, texCoords - direction * offsets[i], 0.0f) * weights[i];
+	}
+}
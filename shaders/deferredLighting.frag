@@ -0,0 +1,170 @@
+#version 410 core
+
+// lights the G-buffer written by basic.frag with GBUFFER_PASS, the same lighting as its forward path
+// FOG, SPOTLIGHT and CLUSTERED_LIGHTS select the features as in basic.frag
+
+out vec4 fColor;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+// sun visibility, specular colour
+uniform sampler2D gMaterial;
+uniform sampler2D gDepth;
+
+uniform mat4 view;
+uniform mat4 inverseViewProjection;
+uniform vec3 cameraPosition;
+
+//lighting
+uniform vec3 lightDir;
+uniform vec3 lightColor;
+float ambientStrength = 0.2f;
+float specularStrength = 0.5f;
+
+//fog
+uniform float fogDensity;
+
+// spotlight
+uniform vec3 spotLightPosition;
+float shininess = 10.0f;
+float spotLightQuadratic = 0.2f;
+float spotLightLinear = 0.22f;
+float spotLightConstant = 1.0f;
+vec3 spotLightColor = vec3(1.0,0.0,0.0);
+
+// street lamp shadows, as in basic.frag
+struct StreetLamp {
+	mat4 lightSpaceTrMatrix;
+	vec4 shadowRect;
+};
+
+layout(std140) uniform StreetLamps {
+	StreetLamp streetLamps[32];
+};
+
+uniform sampler2D lampShadowAtlas;
+
+// night lights binned into clusters of the view frustum, as in basic.frag
+uniform samplerBuffer clusterLightData;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLightIndices;
+uniform ivec3 clusterCount;
+uniform vec2 clusterTileSize;
+uniform float clusterDepthScale;
+uniform float clusterDepthBias;
+
+float computeLampShadow(int lamp, vec3 fragPos)
+{
+	vec4 shadowRect = streetLamps[lamp].shadowRect;
+	if (shadowRect.w == 0.0f)
+		return 0.0f;
+
+	vec4 fragPosLight = streetLamps[lamp].lightSpaceTrMatrix * vec4(fragPos, 1.0f);
+	vec3 normalizedCoords = fragPosLight.xyz / fragPosLight.w * 0.5 + 0.5;
+	if (normalizedCoords.z > 1.0f)
+		return 0.0f;
+
+	float halfTexel = 0.5f / float(textureSize(lampShadowAtlas, 0).x);
+	vec2 tileCoords = shadowRect.xy + clamp(normalizedCoords.xy * shadowRect.z, vec2(halfTexel), vec2(shadowRect.z - halfTexel));
+	float closestDepth = texture(lampShadowAtlas, tileCoords).r;
+	float bias = 0.0005f;
+	return normalizedCoords.z - bias > closestDepth ? 1.0 : 0.0;
+}
+
+// only the lights of the fragment's cluster are visited, the tile and slice bound every light volume
+vec3 computeClusteredLights(vec3 fragPos, vec3 normal, vec3 albedo)
+{
+	float depth = max(-(view * vec4(fragPos, 1.0f)).z, 0.0001f);
+	int slice = clamp(int(log(depth) * clusterDepthScale + clusterDepthBias), 0, clusterCount.z - 1);
+	ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterTileSize), clusterCount.xy - 1);
+	uvec2 lights = texelFetch(clusterGrid, (slice * clusterCount.y + tile.y) * clusterCount.x + tile.x).xy;
+
+	vec3 color = vec3(0.0f);
+	for (uint i = 0u; i < lights.y; i++) {
+		int light = int(texelFetch(clusterLightIndices, int(lights.x + i)).r) * 4;
+		vec4 positionRange = texelFetch(clusterLightData, light);
+
+		vec3 toLight = positionRange.xyz - fragPos;
+		float lightDistance = length(toLight);
+		if (lightDistance > positionRange.w)
+			continue;
+
+		vec4 colorOuterCutoff = texelFetch(clusterLightData, light + 1);
+		vec4 directionInnerCutoff = texelFetch(clusterLightData, light + 2);
+		vec3 lightDirN = toLight / lightDistance;
+		float diff = max(dot(normal, lightDirN), 0.0f);
+		float cone = colorOuterCutoff.w < -0.5f ? 1.0f :
+			smoothstep(colorOuterCutoff.w, directionInnerCutoff.w, dot(-lightDirN, directionInnerCutoff.xyz));
+		if (cone * diff <= 0.0f)
+			continue;
+
+		float falloff = 1.0f - lightDistance / positionRange.w;
+		float shadow = 0.0f;
+		int shadowIndex = int(texelFetch(clusterLightData, light + 3).x);
+		if (shadowIndex >= 0)
+			shadow = computeLampShadow(shadowIndex, fragPos);
+		color += colorOuterCutoff.rgb * albedo * diff * cone * falloff * falloff * (1.0f - shadow);
+	}
+	return color;
+}
+
+vec3 computeLightSpotComponents(vec3 fragPos, vec3 normal, vec3 viewDir, vec3 albedo, vec3 specularColor)
+{
+	vec3 toLight = spotLightPosition - fragPos;
+	float lightDistance = length(toLight);
+	vec3 lightDirN = toLight / lightDistance;
+	vec3 halfVector = normalize(lightDirN + viewDir);
+
+	float diff = max(dot(normal, lightDirN), 0.0f);
+	float spec = pow(max(dot(normal, halfVector), 0.0f), shininess);
+	float attenuation = 1.0f / (spotLightConstant + spotLightLinear * lightDistance + spotLightQuadratic * lightDistance * lightDistance);
+
+	return spotLightColor * (diff * albedo + spec * specularColor) * attenuation;
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gDepth, pixel, 0).r;
+	// nothing was drawn here, the clear colour and the sky box stay
+	if (depth == 1.0f)
+		discard;
+	gl_FragDepth = depth;
+
+	vec3 albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+	vec3 normal = normalize(texelFetch(gNormal, pixel, 0).xyz);
+	vec4 material = texelFetch(gMaterial, pixel, 0);
+	float visibility = material.r;
+	vec3 specularColor = material.gba;
+
+	vec2 screenCoords = (vec2(pixel) + 0.5f) / vec2(textureSize(gDepth, 0));
+	vec4 fragPosClip = inverseViewProjection * vec4(vec3(screenCoords, depth) * 2.0f - 1.0f, 1.0f);
+	vec3 fragPos = fragPosClip.xyz / fragPosClip.w;
+	vec3 viewDir = normalize(cameraPosition - fragPos);
+
+	//directional light, in world space instead of eye space
+	vec3 lightDirN = normalize(lightDir);
+	vec3 ambient = ambientStrength * lightColor;
+	vec3 diffuse = max(dot(normal, lightDirN), 0.0f) * lightColor;
+	vec3 reflectDir = reflect(-lightDirN, normal);
+	vec3 specular = specularStrength * pow(max(dot(viewDir, reflectDir), 0.0f), 32) * lightColor;
+
+	vec3 color = min((ambient + visibility * diffuse) * albedo + visibility * specular * specularColor, 1.0f);
+
+#ifdef SPOTLIGHT
+	color += computeLightSpotComponents(fragPos, normal, viewDir, albedo, specularColor);
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+	color += computeClusteredLights(fragPos, normal, albedo);
+#endif
+
+#ifdef FOG
+	float fragmentDistance = length(cameraPosition - fragPos);
+	float fogFactor = clamp(exp(-pow(fragmentDistance * fogDensity, 2)), 0.0f, 1.0f);
+	vec4 fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
+	fColor = mix(fogColor, min(vec4(color, 1.0f), 1.0f), fogFactor);
+#else
+	fColor = vec4(color, 1.0f);
+#endif
+}
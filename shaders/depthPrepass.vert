@@ -0,0 +1,15 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// must match basic.vert exactly, the colour pass tests depth with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+}
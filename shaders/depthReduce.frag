@@ -0,0 +1,82 @@
+#version 410 core
+
+const int maxPartitions = 4;
+
+// previous level of the chain, or the depth buffer on the first pass
+uniform sampler2D source;
+// previous level of the partition bounds, one layer per partition, unused on the first pass
+uniform sampler2DArray sourceBounds;
+// the first pass converts depth to view space distance and skips the cleared background
+uniform int linearize;
+// of the projection the depth was drawn with
+uniform mat4 inverseProjection;
+// from the view the depth was drawn with to the light view the bounds are in
+uniform mat4 viewToLight;
+// view space distance where each partition ends
+uniform float partitionSplits[maxPartitions];
+uniform int partitionCount;
+
+layout(location = 0) out vec2 depthRange;
+// minX, minY, maxX, maxY in light view space of the samples of each partition
+layout(location = 1) out vec4 partitionBounds[maxPartitions];
+
+vec3 viewPosition(ivec2 texel, ivec2 size, float depth)
+{
+	vec3 ndc = vec3((vec2(texel) + 0.5f) / vec2(size), depth) * 2.0f - 1.0f;
+	vec4 position = inverseProjection * vec4(ndc, 1.0f);
+	return position.xyz / position.w;
+}
+
+void main()
+{
+	ivec2 size = textureSize(source, 0);
+	ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+
+	//odd sizes fold the last row or column into the last texel
+	int extentX = base.x + 3 == size.x ? 3 : 2;
+	int extentY = base.y + 3 == size.y ? 3 : 2;
+
+	vec2 range = vec2(3.402823e38f, 0.0f);
+	vec4 bounds[maxPartitions];
+	for (int i = 0; i < maxPartitions; i++) {
+		bounds[i] = vec4(3.402823e38f, 3.402823e38f, -3.402823e38f, -3.402823e38f);
+	}
+
+	for (int y = 0; y < extentY; y++) {
+		for (int x = 0; x < extentX; x++) {
+			ivec2 texel = min(base + ivec2(x, y), size - 1);
+			if (linearize == 1) {
+				float depth = texelFetch(source, texel, 0).r;
+				if (depth < 1.0f) {
+					vec3 position = viewPosition(texel, size, depth);
+					float viewDepth = -position.z;
+					range = vec2(min(range.x, viewDepth), max(range.y, viewDepth));
+
+					// nearer than the first split falls in the first partition, samples past the last are not shadowed
+					int bin = 0;
+					while (bin < partitionCount && viewDepth > partitionSplits[bin]) {
+						bin++;
+					}
+					if (bin < partitionCount) {
+						vec2 lightPosition = (viewToLight * vec4(position, 1.0f)).xy;
+						bounds[bin] = vec4(min(bounds[bin].xy, lightPosition),
+							max(bounds[bin].zw, lightPosition));
+					}
+				}
+			}
+			else {
+				vec2 texelRange = texelFetch(source, texel, 0).rg;
+				range = vec2(min(range.x, texelRange.x), max(range.y, texelRange.y));
+				for (int i = 0; i < partitionCount; i++) {
+					vec4 texelBounds = texelFetch(sourceBounds, ivec3(texel, i), 0);
+					bounds[i] = vec4(min(bounds[i].xy, texelBounds.xy), max(bounds[i].zw, texelBounds.zw));
+				}
+			}
+		}
+	}
+
+	depthRange = range;
+	for (int i = 0; i < maxPartitions; i++) {
+		partitionBounds[i] = bounds[i];
+	}
+}
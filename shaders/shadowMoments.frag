@@ -0,0 +1,16 @@
+#version 410 core
+
+// exponential variance shadow map: the warped depth and its square, for a positive and a
+// negative exponent, so the map can be blurred and filtered like any other texture
+const float positiveExponent = 40.0f;
+const float negativeExponent = 5.0f;
+
+out vec4 fMoments;
+
+void main()
+{
+	float depth = gl_FragCoord.z * 2.0f - 1.0f;
+	float positive = exp(positiveExponent * depth);
+	float negative = -exp(-negativeExponent * depth);
+	fMoments = vec4(positive, positive * positive, negative, negative * negative);
+}
@@ -0,0 +1,14 @@
+#version 410 core
+
+in vec2 fTexCoords;
+
+out vec4 fColor;
+
+uniform sampler2D font;
+
+void main()
+{
+	//white ink over a translucent dark cell
+	float ink = texture(font, fTexCoords).r;
+	fColor = vec4(vec3(ink), mix(0.6f, 1.0f, ink));
+}
@@ -0,0 +1,13 @@
+#version 410 core
+
+layout(location=0) in vec2 vPosition;
+layout(location=1) in vec2 vTexCoords;
+
+out vec2 fTexCoords;
+
+void main()
+{
+	//positions arrive in clip space
+	fTexCoords = vTexCoords;
+	gl_Position = vec4(vPosition, 0.0f, 1.0f);
+}